@@ -0,0 +1,317 @@
+#include <limits.h>
+#include "Compile.h"
+
+/*
+
+Compiler
+- takes a program that has already been read into lvals and writes it out
+  as a C file, so scripts that never change can skip reading and parsing
+- the C file links against Lval.c, so everything that isn't plain
+  arithmetic still goes through the same constructors and builtins the
+  interpreter uses
+- when every operand of + - * / is a number (or more arithmetic), we know
+  the types ahead of time and do the maths on longs, only making a lval
+  at the end
+
+
+ compile a script and build it
+ ./parsing -c script.lspy > script.c
+ cc -std=c99 -Wall -O2 script.c Lval.c mpc.c -lm -o script
+
+ every top level form in the script gets its result printed, one per line
+*/
+
+
+/* CHECKING TYPES */
+
+//checks if v is one of the maths symbols
+static int lval_is_op(lval* v){
+	return v->type == LVAL_SYM && strlen(v->sym) == 1 && strstr("+-*/", v->sym);
+}
+
+//checks if v will always evaluate to a number (or a division by zero error)
+//numbers, (op numeric numeric ...) and (numeric) qualify
+static int lval_is_numeric(lval* v){
+	if(v->type == LVAL_NUM){ return 1; }
+	if(v->type != LVAL_SEXPR){ return 0; }
+
+	//a single expression evaluates to itself, hence (5) is 5
+	if(v->count == 1){ return lval_is_numeric(v->cell[0]); }
+
+	if(v->count < 2 || !lval_is_op(v->cell[0])){ return 0; }
+	for(int i = 1; i < v->count; i++){
+		if(!lval_is_numeric(v->cell[i])){ return 0; }
+	}
+	return 1;
+}
+
+//finds the number literal at the bottom of (((5))), or NULL if there isn't one
+static lval* lval_literal(lval* v){
+	while(v->type == LVAL_SEXPR && v->count == 1){ v = v->cell[0]; }
+	return v->type == LVAL_NUM ? v : NULL;
+}
+
+//checks if evaluating numeric v could divide by zero
+//dividing by a literal that isn't zero never can, so we skip the check
+static int lval_has_div(lval* v){
+	if(v->type != LVAL_SEXPR){ return 0; }
+	if(v->count >= 3 && lval_is_op(v->cell[0]) && v->cell[0]->sym[0] == '/'){
+		for(int i = 2; i < v->count; i++){
+			lval* lit = lval_literal(v->cell[i]);
+			if(!lit || lit->num == 0){ return 1; }
+		}
+	}
+	for(int i = 0; i < v->count; i++){
+		if(lval_has_div(v->cell[i])){ return 1; }
+	}
+	return 0;
+}
+
+//number of long temporaries needed by lval_compile_long
+//the first operand reuses the result's temporary, every other operand
+//that isn't a literal needs one more on top of it
+static int lval_temps(lval* v){
+	if(lval_literal(v)){ return 1; }
+	if(v->count == 1){ return lval_temps(v->cell[0]); }
+
+	int n = lval_temps(v->cell[1]);
+	for(int i = 2; i < v->count; i++){
+		if(!lval_literal(v->cell[i]) && lval_temps(v->cell[i]) + 1 > n){
+			n = lval_temps(v->cell[i]) + 1;
+		}
+	}
+	return n;
+}
+
+
+/* WRITING C */
+
+//writes a long literal, LONG_MIN has no literal of its own in C
+static void lval_compile_num(long x, FILE* out){
+	if(x == LONG_MIN){
+		fprintf(out, "(%ldL - 1)", x + 1);
+	} else {
+		fprintf(out, "%ldL", x);
+	}
+}
+
+//writes s as a C string literal
+static void lval_compile_string(char* s, FILE* out){
+	fputc('"', out);
+	for(; *s; s++){
+		if(*s == '"' || *s == '\\'){
+			fprintf(out, "\\%c", *s);
+		} else if(isprint((unsigned char)*s)){
+			fputc(*s, out);
+		} else {
+			fprintf(out, "\\%03o", (unsigned char)*s);
+		}
+	}
+	fputc('"', out);
+}
+
+//writes statements that leave the value of numeric v in temporary t
+//division by zero jumps to the err label of the enclosing function
+static void lval_compile_long(lval* v, int t, FILE* out){
+	lval* lit = lval_literal(v);
+	if(lit){
+		fprintf(out, "\tt%d = ", t);
+		lval_compile_num(lit->num, out);
+		fprintf(out, ";\n");
+		return;
+	}
+	if(v->count == 1){
+		lval_compile_long(v->cell[0], t, out);
+		return;
+	}
+
+	char op = v->cell[0]->sym[0];
+	lval_compile_long(v->cell[1], t, out);
+
+	//unary negation, same as builtin_op
+	if(op == '-' && v->count == 2){
+		fprintf(out, "\tt%d = -t%d;\n", t, t);
+		return;
+	}
+
+	for(int i = 2; i < v->count; i++){
+		lit = lval_literal(v->cell[i]);
+		if(lit){
+			if(op == '/' && lit->num == 0){
+				fprintf(out, "\tgoto err;\n");
+				return;
+			}
+			fprintf(out, "\tt%d %c= ", t, op);
+			lval_compile_num(lit->num, out);
+			fprintf(out, ";\n");
+		} else {
+			lval_compile_long(v->cell[i], t+1, out);
+			if(op == '/'){
+				fprintf(out, "\tif(t%d == 0){ goto err; }\n", t+1);
+			}
+			fprintf(out, "\tt%d %c= t%d;\n", t, op, t+1);
+		}
+	}
+}
+
+//writes the declarations of the temporaries for numeric v
+static void lval_compile_temps(lval* v, FILE* out){
+	int n = lval_temps(v);
+	fprintf(out, "\tlong t0");
+	for(int i = 1; i < n; i++){
+		fprintf(out, ", t%d", i);
+	}
+	fprintf(out, ";\n");
+}
+
+//forward declaration
+static int lval_compile_eval(lval* v, int* count, FILE* out);
+
+//writes a function building v exactly as it is written, without evaluating it
+//used for the insides of q-expressions
+//returns the number of the function written, or -1 if v is an atom
+static int lval_compile_quote(lval* v, int* count, FILE* out){
+	if(v->type != LVAL_SEXPR && v->type != LVAL_QEXPR){ return -1; }
+
+	//the functions for the children have to come before this one
+	int* fns = malloc(sizeof(int) * (v->count + 1));
+	for(int i = 0; i < v->count; i++){
+		fns[i] = lval_compile_quote(v->cell[i], count, out);
+	}
+
+	int n = (*count)++;
+	fprintf(out, "static lval* jl_%d(void){\n", n);
+	fprintf(out, "\tlval* v = %s;\n", v->type == LVAL_SEXPR ? "lval_sexpr()" : "lval_qexpr()");
+	for(int i = 0; i < v->count; i++){
+		fprintf(out, "\tv = lval_add(v, ");
+		if(fns[i] >= 0){
+			fprintf(out, "jl_%d()", fns[i]);
+		} else {
+			lval_compile_eval(v->cell[i], count, out);
+		}
+		fprintf(out, ");\n");
+	}
+	fprintf(out, "\treturn v;\n}\n\n");
+
+	free(fns);
+	return n;
+}
+
+//writes a function that evaluates v
+//atoms evaluate to themselves, so for those we write their constructor
+//inline instead and return -1
+static int lval_compile_eval(lval* v, int* count, FILE* out){
+	int n;
+
+	switch(v->type){
+		case LVAL_NUM:
+			fprintf(out, "lval_num(");
+			lval_compile_num(v->num, out);
+			fprintf(out, ")");
+			return -1;
+		case LVAL_ERR:
+			fprintf(out, "lval_err(");
+			lval_compile_string(v->err, out);
+			fprintf(out, ")");
+			return -1;
+		case LVAL_SYM:
+			fprintf(out, "lval_sym(");
+			lval_compile_string(v->sym, out);
+			fprintf(out, ")");
+			return -1;
+		case LVAL_QEXPR:
+			return lval_compile_quote(v, count, out);
+	}
+
+	//arithmetic we can do on longs, boxed into a lval at the end
+	if(lval_is_numeric(v)){
+		n = (*count)++;
+		fprintf(out, "static lval* jl_%d(void){\n", n);
+		lval_compile_temps(v, out);
+		lval_compile_long(v, 0, out);
+		fprintf(out, "\treturn lval_num(t0);\n");
+		if(lval_has_div(v)){
+			fprintf(out, "err:\n\treturn lval_err(\"Error: Division by Zero\");\n");
+		}
+		fprintf(out, "}\n\n");
+		return n;
+	}
+
+	//everything else evaluates its children, then hands them to the builtins
+	int* fns = malloc(sizeof(int) * (v->count + 1));
+	for(int i = 0; i < v->count; i++){
+		fns[i] = v->cell[i]->type == LVAL_SEXPR || v->cell[i]->type == LVAL_QEXPR
+			? lval_compile_eval(v->cell[i], count, out) : -1;
+	}
+
+	n = (*count)++;
+	fprintf(out, "static lval* jl_%d(void){\n", n);
+	fprintf(out, "\tlval* v = lval_sexpr();\n");
+	for(int i = 0; i < v->count; i++){
+		fprintf(out, "\tv = lval_add(v, ");
+		if(fns[i] >= 0){
+			fprintf(out, "jl_%d()", fns[i]);
+		} else {
+			lval_compile_eval(v->cell[i], count, out);
+		}
+		fprintf(out, ");\n");
+	}
+	fprintf(out, "\treturn lval_call(v);\n}\n\n");
+
+	free(fns);
+	return n;
+}
+
+//writes a function that evaluates numeric v and prints it, without ever
+//making a lval for it
+static int lval_compile_print_long(lval* v, int* count, FILE* out){
+	int n = (*count)++;
+	fprintf(out, "static void jl_%d(void){\n", n);
+	lval_compile_temps(v, out);
+	lval_compile_long(v, 0, out);
+	fprintf(out, "\tprintf(\"%%li\\n\", t0);\n");
+	if(lval_has_div(v)){
+		fprintf(out, "\treturn;\nerr:\n\tputs(\"Error: Error: Division by Zero\");\n");
+	}
+	fprintf(out, "}\n\n");
+	return n;
+}
+
+void lval_compile(lval* v, char* name, FILE* out){
+	int count = 0;
+	int* fns = malloc(sizeof(int) * (v->count + 1));
+
+	fprintf(out, "/* Compiled from %s by JLispy */\n\n", name);
+	fprintf(out, "#include \"Lval.h\"\n\n");
+
+	//functions for every top level form
+	for(int i = 0; i < v->count; i++){
+		if(lval_is_numeric(v->cell[i]) && v->cell[i]->type != LVAL_NUM){
+			fns[i] = lval_compile_print_long(v->cell[i], &count, out);
+		} else if(v->cell[i]->type == LVAL_SEXPR || v->cell[i]->type == LVAL_QEXPR){
+			fns[i] = lval_compile_eval(v->cell[i], &count, out);
+		} else {
+			fns[i] = -1;
+		}
+	}
+
+	//main runs the forms in order and prints each result
+	fprintf(out, "int main(void){\n");
+	fprintf(out, "\tlval* x;\n");
+	for(int i = 0; i < v->count; i++){
+		if(lval_is_numeric(v->cell[i]) && v->cell[i]->type != LVAL_NUM){
+			fprintf(out, "\tjl_%d();\n", fns[i]);
+			continue;
+		}
+		fprintf(out, "\tx = ");
+		if(fns[i] >= 0){
+			fprintf(out, "jl_%d()", fns[i]);
+		} else {
+			lval_compile_eval(v->cell[i], &count, out);
+		}
+		fprintf(out, ";\n\tlval_println(x);\n\tlval_del(x);\n");
+	}
+	fprintf(out, "\treturn 0;\n}\n");
+
+	free(fns);
+}
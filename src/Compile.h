@@ -0,0 +1,11 @@
+#ifndef Compile
+#define Compile
+
+#include "Lval.h"
+
+/* Compiler Functions */
+//writes a standalone C file for the program v to out
+//v is the sexpr read from a whole script, each cell is one top level form
+void lval_compile(lval* v, char* name, FILE* out);
+
+#endif
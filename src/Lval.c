@@ -1,6 +1,9 @@
 #include "Lval.h"
 
-/* Define Lval Constructors */
+/* LVAL CONSTRUCTORS */
+//lval constructors now return a pointer to lval object, this will
+//make it easier to reference in a lval cell list
+
 //constructs a pointer to lval type number
 lval* lval_num(long x){
 	lval* v = malloc(sizeof(lval));
@@ -45,8 +48,17 @@ lval* lval_sexpr(void){
 
 }
 
+//constructor for Qexpr
+lval* lval_qexpr(void){
+	lval* v=malloc(sizeof(lval));
+	v->type = LVAL_QEXPR;
+	v->count = 0;
+	v->cell = NULL;
+	return v;
+
+}
 
-/* Define Deconstructor for Lval */
+/* DEALLOCATOR FOR LVAL */
 void lval_del(lval* v){
 	switch(v->type){
 
@@ -61,7 +73,9 @@ void lval_del(lval* v){
 			free(v->sym);
 			break;
 
+		//if lval type is LVAL_SEXPR or LVAL_QEXPR
 		case LVAL_SEXPR:
+		case LVAL_QEXPR:
 			//deallocates each lval in the cell
 			for(int i =0; i<v->count; i++){
 				lval_del(v->cell[i]);
@@ -73,4 +87,405 @@ void lval_del(lval* v){
 	//finally deallocates the pointer to v 
 	free(v);
 
-}
\ No newline at end of file
+}
+
+/* READING EXPRESSION FUNCTIONS */
+
+//adds lval y to lval v's cell
+lval* lval_add(lval* v, lval* y){
+	v->count++;
+	//reallocates the size of v
+	v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+	//sets the last cell in the list to y
+	v->cell[v->count-1] = y;
+
+	return v;
+}
+
+//number action, text is the matched number
+mpc_val_t* lval_action_num(const char* text, int n, mpc_val_t** xs){
+	errno = 0;
+	long x = strtol(text, NULL, 10);
+	return errno != ERANGE ? lval_num(x) : lval_err("invalid_number");
+
+}
+
+//symbol action, text is the matched symbol
+mpc_val_t* lval_action_sym(const char* text, int n, mpc_val_t** xs){
+	return lval_sym((char*)text);
+
+}
+
+//sexpr action, xs are the lvals of the expressions inside the brackets
+//also used for the root, which holds every expression read
+mpc_val_t* lval_action_sexpr(const char* text, int n, mpc_val_t** xs){
+	lval* x = lval_sexpr();
+	for(int i = 0; i < n; i++){
+		x = lval_add(x, xs[i]);
+	}
+	return x;
+
+}
+
+//qexpr action, same as sexpr but for { }
+mpc_val_t* lval_action_qexpr(const char* text, int n, mpc_val_t** xs){
+	lval* x = lval_qexpr();
+	for(int i = 0; i < n; i++){
+		x = lval_add(x, xs[i]);
+	}
+	return x;
+
+}
+
+/* LVAL Printing Functions */
+
+//forward declaration of lval_print
+void lval_print(lval* v);
+
+//this function will be called when the lval type is SEXPR
+//open and close will be '(' and ')' from lval_print
+void lval_expr_print(lval* v, char open, char close){
+
+	//putchar writes a character to stdout
+	putchar(open);
+
+	//remember v will be the root of the tree
+	for(int i =0; i< v->count; i++){
+
+		//prints values within cell
+		lval_print(v->cell[i]);
+
+		//prints trailing space when element is not last 
+		if(i != (v->count-1)){
+			putchar(' ');
+		}
+	}
+	putchar(close);
+
+
+} 
+
+
+//prints out lval
+void lval_print(lval* v){
+	switch(v->type){
+		//lval type number case
+		case LVAL_NUM:
+			//prints the long value
+			printf("%li", v->num);
+			break;
+		case LVAL_ERR:
+			printf("Error: %s",v->err );
+			break;
+		case LVAL_SYM:
+			printf("%s", v->sym);
+			break;
+		case LVAL_SEXPR:
+			//if the lval is a sexpr, when we print, we encase it with ()
+			lval_expr_print(v, '(',')');
+			break;
+		case LVAL_QEXPR:
+			lval_expr_print(v, '{','}');
+			break;
+
+	}
+
+}
+
+void lval_println(lval* v){
+	lval_print(v);
+	putchar('\n');
+}
+
+
+/* LVAL Compare Functions */
+
+//checks if x and y are the same value, lists are compared cell by cell
+int lval_eq(lval* x, lval* y){
+	if(x->type != y->type){ return 0; }
+
+	switch(x->type){
+		case LVAL_NUM: return x->num == y->num;
+		case LVAL_ERR: return strcmp(x->err, y->err) == 0;
+		case LVAL_SYM: return strcmp(x->sym, y->sym) == 0;
+	}
+
+	if(x->count != y->count){ return 0; }
+	for(int i = 0; i < x->count; i++){
+		if(!lval_eq(x->cell[i], y->cell[i])){ return 0; }
+	}
+	return 1;
+
+}
+
+lval* lval_eval(lval* v);
+lval* lval_pop(lval* v, int index);
+lval* lval_take(lval* v, int index);
+lval* builtin_op(lval* v, char* op);
+lval* builtin(lval* a, char* func);
+
+/* Eval functions */
+
+//evaluates the lval, starts by evaluating the children first
+//if any child is an error, return that lval
+//if the lval is an empty expression, hence (), return the lval directly 
+//if the lval is a single expression, hence (5), return the single expression
+lval* lval_eval_sexpr(lval* v){
+
+	//Evaluates children 
+	for(int i =0; i< v->count; i++){
+		//evaulates each children
+		//transforms each child and sets it in original cell 
+		v->cell[i] = lval_eval(v->cell[i]);
+
+	}
+
+	return lval_call(v);
+
+}
+
+//applies an s-expression whose children have already been evaluated
+//the first child is the function symbol, the rest are its arguments
+//compiled programs call this directly since they evaluate the children themselves
+lval* lval_call(lval* v){
+
+	//checks children for errors, returns child if error found
+  	for (int i = 0; i < v->count; i++) {
+    	if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+  	}
+
+	//checks empty expression
+	if(v->count == 0){ 
+
+		return v; 
+	}
+
+	//checks single expression
+	if(v->count == 1){
+		return lval_take(v,0);
+	}
+
+	//ensure first element is a symbol
+	//if not, return error
+	lval* f = lval_pop(v, 0);
+	if(f->type != LVAL_SYM){
+		lval_del(f);
+		lval_del(v);
+		return lval_err("S-Expression does not start with symbol");
+	}
+
+	//call builtin with operator
+	//evaluates lval with symbol
+	lval* result = builtin(v, f->sym);
+	lval_del(f);
+	return result;
+
+
+}
+
+lval* lval_eval(lval* v){
+	//evaluates sexpr expressions
+	if(v->type == LVAL_SEXPR){
+		return lval_eval_sexpr(v);
+	}
+	//return all other types 
+	return v;
+}
+
+//pops lval object at index from v's cell list
+//we popout the symbol, so that we can just have a "list" of numbers to
+//do the evalutation on
+lval* lval_pop(lval* v, int index){
+	//gets lval at index
+	lval* x = v->cell[index];
+
+	//shifts memory after lval at index is popped
+	memmove(&v->cell[index], &v->cell[index+1],sizeof(lval*) * (v->count-index-1) );
+
+	//descrease count after popping item
+	v->count--;
+
+	//reallocates lval cell memory
+	v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+
+	//return popped object
+	return x;
+
+}
+
+//gets the lval at index and deletes original lval object afterwards
+lval* lval_take(lval* v, int index){
+	lval* x = lval_pop(v, index);
+	lval_del(v);
+	return x;
+
+}
+
+//takes in a lval object which represents all the 
+lval* builtin_op(lval* a, char* op){
+
+	//checks if all objects in v are numbers
+	for(int i=0; i< a->count; i++){
+		if(a->cell[i]->type != LVAL_NUM){
+			lval_del(a);
+			return lval_err("Error: Cannot operator on non-numerics");
+		}
+	}
+
+	//pops the first element
+	//all evaluations will be stored in x
+	lval* x = lval_pop(a,0);
+
+	//if no arguments and sub then perform unary negation
+	//hence, if a is just a number with no other expressions and has a op of '-' 
+	//then we just make it negative
+	if((strcmp(op,"-") == 0 ) && a->count ==0){
+		x->num = -x->num;
+	}
+
+	//while there are still remaining elements 
+	while(a->count > 0){
+
+		//pops the next element
+		lval* y = lval_pop(a,0);
+
+		//strcmp returns 0 if the two strings are equal 
+		//returns a lval object with num equal to performed operation 
+		if(strcmp(op, "+") == 0){ x->num += y->num; }
+		else if(strcmp(op, "-") == 0){ x->num -= y->num; }
+		else if(strcmp(op, "*") == 0){ x->num *= y->num; }
+		else if(strcmp(op, "/") == 0){ 
+			if(y->num == 0){
+				return lval_err("Error: Division by Zero");
+				break;
+			}
+
+			x->num /= y->num; 
+		}
+		//deallocate y after evaluation
+		lval_del(y);
+	}
+	//deallocate a after evaluation
+	lval_del(a);
+	return x;
+
+
+}
+
+//MACRO: reprocessor statement for creating 
+//function-like-things that are evaluated before the program is compiled.
+//can be used to do better error checking
+//its like python assert statments 
+
+#define LASSERT(args, cond, err) \
+	if(!(cond)){lval_del(args); return lval_err(err);}
+
+//q expressions
+lval* builtin_head(lval* a){
+
+	//error checking
+
+	//the lval we are passing in essentially holds another lval object
+	//that will contain the data, hence, a lval object type qexpr will have 
+	//one lval object in it's cell with all the other numbers/expressions
+	LASSERT(a, a->count == 1,"Function 'head' passed too many arguments!");
+
+	LASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function 'head' passed incorrect types!");
+
+	LASSERT(a,a->cell[0]->count != 0, "Function 'head' passed {}!");
+
+	lval* v = lval_take(a, 0);
+	while(v->count > 1){
+		lval_del(lval_pop(v,1));
+
+	}
+	return v;
+
+
+
+}
+
+lval* builtin_tail(lval* a){
+	//error checking
+	LASSERT(a, a->count == 1,"Function 'tail' passed too many arguments!");
+
+	LASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function 'tail' passed incorrect types!");
+
+	LASSERT(a,a->cell[0]->count != 0, "Function 'tail' passed {}!");
+
+	lval* v= lval_take(a,0);
+	//delete and return the first item 
+	lval_del(lval_pop(v,0));
+	return v;
+
+
+}
+
+//converts a s-expression into a q-expression
+lval* builtin_list(lval* a){
+	a->type = LVAL_QEXPR;
+	return a;
+
+}
+
+//converts q-expression to s-expression
+lval* builtin_eval(lval* a){
+	//error checking
+	LASSERT(a, a->count == 1,"Function 'eval' passed too many arguments!");
+
+	LASSERT(a, a->cell[0]->type == LVAL_QEXPR, "Function 'eval' passed incorrect types!");
+
+	//gets the stored values
+	lval* x = lval_take(a,0);
+
+	//converts the stored lval into type LVAL_SEXPR
+	x->type = LVAL_SEXPR;
+	return lval_eval(x);
+
+
+
+}
+
+lval* lval_join(lval* x, lval* y);
+
+//first check if all arguments are q expressions
+//then we join them one by one
+lval* builtin_join(lval* a){
+
+	//checks if all arguments are q-expressions
+	for(int i=0; i<a->count; i++){
+		LASSERT(a, a->cell[i]->type == LVAL_QEXPR, "Function 'join' passed incorrect types!");
+
+	}
+
+	//the lval expressions will be joined into x
+	lval* x = lval_pop(a, 0);
+	while(a->count){
+		x=lval_join(x, lval_pop(a,0));
+	}
+
+	lval_del(a);
+	return x;
+
+}
+
+lval* lval_join(lval* x, lval* y){
+	while(y->count){
+		x = lval_add(x, lval_pop(y,0));
+
+	}
+	lval_del(y);
+	return x;
+
+}
+
+lval* builtin(lval* a, char* func){
+	if (strcmp("list", func) == 0) { return builtin_list(a); }
+    if (strcmp("head", func) == 0) { return builtin_head(a); }
+ 	if (strcmp("tail", func) == 0) { return builtin_tail(a); }
+    if (strcmp("join", func) == 0) { return builtin_join(a); }
+    if (strcmp("eval", func) == 0) { return builtin_eval(a); }
+    if (strstr("+-/*", func)) { return builtin_op(a, func); }
+    lval_del(a);
+    return lval_err("Unknown Function!");
+}
@@ -29,24 +29,31 @@ typedef struct lval{
 
 /* enum for Lval types */
 //Chapter 9: added 2 more types, LVAL_SYM, LVAL_SEXPR, for S-Expressions
-enum{LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_SEXPR};
+//Chapter 10: added LVAL_QEXPR for Q-Expressions
+enum{LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR};
 
 
 /* Lval Constructors */
 lval* lval_num(long x);
-lval* lval_err(char err);
+lval* lval_err(char* x);
 lval* lval_sym(char* s);
 lval* lval_sexpr(void);
+lval* lval_qexpr(void);
 
 /* Lval Deconstructor */
 void lval_del(lval* v);
 
 
 /* Lval Read Functions */
-lval* lval_read_num(lval* v);
-lval* lval_read(mpc_ast_t* t);
 lval* lval_add(lval* v, lval* y);
 
+//actions for mpca_lang_actions, these make the lvals while the grammar is
+//parsing so there is no mpc_ast_t to read afterwards
+mpc_val_t* lval_action_num(const char* text, int n, mpc_val_t** xs);
+mpc_val_t* lval_action_sym(const char* text, int n, mpc_val_t** xs);
+mpc_val_t* lval_action_sexpr(const char* text, int n, mpc_val_t** xs);
+mpc_val_t* lval_action_qexpr(const char* text, int n, mpc_val_t** xs);
+
 
 /* Lval Print Functions */
 void lval_expr_print(lval* v, char open, char close);
@@ -54,14 +61,29 @@ void lval_print(lval* v);
 void lval_println(lval* v);
 
 
+/* Lval Compare Functions */
+int lval_eq(lval* x, lval* y);
+
+
 /* Lval Evaluate Functions */
 //Eval functions can be thought as a transformer, where we take a Lval* and 
 //transform it into a new/different Lval*
 lval* lval_eval_sexpr(lval* v); 
 lval* lval_eval(lval* v);
+lval* lval_call(lval* v);
 lval* lval_pop(lval* v, int index);
 lval* lval_take(lval*v, int index);
+lval* lval_join(lval* x, lval* y);
+
+
+/* Builtin Functions */
 lval* builtin_op(lval*a, char* op);
+lval* builtin_head(lval* a);
+lval* builtin_tail(lval* a);
+lval* builtin_list(lval* a);
+lval* builtin_eval(lval* a);
+lval* builtin_join(lval* a);
+lval* builtin(lval* a, char* func);
 
 
 
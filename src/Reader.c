@@ -0,0 +1,304 @@
+#include "Reader.h"
+
+/*
+
+Reader
+- reads the same language as the jlispy grammar in parsing.c, but builds the
+  lvals as it goes instead of running the grammar and its actions
+- one pass over the input, no backtracking: the first character of a token
+  decides what it is, in the same order expr tries its alternatives
+  (number, then symbol, then sexpr, then qexpr)
+- lists are kept on a stack instead of recursing, so deeply nested input
+  can't run us out of C stack
+- syntax errors are reported as "file:row:col: error: expected ... at ..."
+  the same shape mpc_err_print uses
+- files are read in blocks, everything before the token being read can be
+  dropped, so memory only grows with the biggest expression
+- row and col are counted over the bytes a refill drops, since they are gone
+  by the time an error needs them, the rest are only counted on an error,
+  so reading a string never counts at all
+
+ the mpc grammar is still there, ./parsing -m reads with it instead and
+ ./parsing -v reads with both and complains if they disagree
+*/
+
+
+/* READER CONSTRUCTORS */
+
+//constructs a reader over the string s, s has to outlive the reader
+lreader* lreader_new_string(char* filename, char* s){
+	lreader* r = malloc(sizeof(lreader));
+	r->filename = malloc(strlen(filename) + 1);
+	strcpy(r->filename, filename);
+
+	r->buf = s;
+	r->owned = 0;
+	r->len = strlen(s);
+	r->pos = 0;
+	r->file = NULL;
+	r->size = r->len;
+	r->row = 0;
+	r->col = 0;
+	r->error = 0;
+	return r;
+
+}
+
+//size of the blocks files are read in
+#define LREADER_BLOCK 65536
+
+//constructs a reader over everything left in the file f
+//nothing is read until the first expression is asked for
+lreader* lreader_new_file(char* filename, FILE* f){
+	lreader* r = malloc(sizeof(lreader));
+	r->filename = malloc(strlen(filename) + 1);
+	strcpy(r->filename, filename);
+
+	r->size = LREADER_BLOCK;
+	r->buf = malloc(r->size + 1);
+	r->buf[0] = '\0';
+	r->owned = 1;
+	r->len = 0;
+	r->pos = 0;
+	r->file = f;
+	r->row = 0;
+	r->col = 0;
+	r->error = 0;
+	return r;
+
+}
+
+
+/* DEALLOCATOR FOR READER */
+void lreader_del(lreader* r){
+	free(r->filename);
+	if(r->owned){ free(r->buf); }
+	free(r);
+
+}
+
+
+/* READING CHARACTERS */
+
+//adds the rows and cols of the first n bytes of buf onto row and col
+static void lreader_count(lreader* r, long n, long* row, long* col){
+	for(long i = 0; i < n; i++){
+		if(r->buf[i] == '\n'){ (*row)++; *col = 0; } else { (*col)++; }
+	}
+}
+
+//reads from the file until there are more than k bytes after the read
+//position, or the file runs out
+static void lreader_fill(lreader* r, long k){
+
+	//drop everything before the read position, tokens start there
+	lreader_count(r, r->pos, &r->row, &r->col);
+	memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+	r->len -= r->pos;
+	r->pos = 0;
+
+	while(r->file && r->len <= k){
+		//only a token longer than the buffer needs more room
+		if(r->len == r->size){
+			r->size *= 2;
+			r->buf = realloc(r->buf, r->size + 1);
+		}
+
+		size_t n = fread(r->buf + r->len, 1, r->size - r->len, r->file);
+		if(n == 0){ r->file = NULL; }
+
+		//the grammar stops at the first null byte, so we do too
+		char* end = memchr(r->buf + r->len, '\0', n);
+		if(end){
+			n = end - (r->buf + r->len);
+			r->file = NULL;
+		}
+		r->len += n;
+	}
+
+	//strtol needs the end of a number at the end of the buffer marked
+	r->buf[r->len] = '\0';
+
+}
+
+//character k places ahead of the read position, '\0' past the end of input
+static char lreader_peek(lreader* r, long k){
+	if(r->pos + k >= r->len && r->file){ lreader_fill(r, k); }
+	return r->pos + k < r->len ? r->buf[r->pos + k] : '\0';
+}
+
+//same whitespace as mpc_whitespace, which the grammar skips after every token
+static int lreader_space(char c){
+	return c == ' ' || c == '\f' || c == '\n' || c == '\r' || c == '\t' || c == '\v';
+}
+
+static void lreader_skip(lreader* r){
+	while(lreader_space(lreader_peek(r, 0))){ r->pos++; }
+}
+
+//checks if the input at the read position starts with s
+static int lreader_match(lreader* r, char* s){
+	for(long i = 0; s[i]; i++){
+		if(lreader_peek(r, i) != s[i]){ return 0; }
+	}
+	return 1;
+}
+
+
+/* READING ERRORS */
+
+//makes the error for a token we couldn't read at the read position
+//expected is what the grammar would have taken there instead
+static lval* lreader_err(lreader* r, char* expected){
+
+	//describes the character the same way mpc_err_print does
+	char c = lreader_peek(r, 0);
+
+	//row and col start at 0 like mpc_state_t, they are printed + 1
+	long row = r->row, col = r->col;
+	lreader_count(r, r->pos, &row, &col);
+	char at[16];
+	switch(c){
+		case '\0': strcpy(at, "end of input"); break;
+		case '\a': strcpy(at, "bell"); break;
+		case '\b': strcpy(at, "backspace"); break;
+		default: sprintf(at, "'%c'", c); break;
+	}
+
+	char* msg = malloc(strlen(r->filename) + strlen(expected) + 128);
+	sprintf(msg, "%s:%ld:%ld: error: expected %s at %s",
+		r->filename, row + 1, col + 1, expected, at);
+	lval* x = lval_err(msg);
+	free(msg);
+	r->error = 1;
+	return x;
+
+}
+
+
+/* READING EXPRESSIONS */
+
+//the symbols from the grammar, in the order it tries them
+static char* lreader_symbols[] = {
+	"list", "head", "tail", "join", "eval", "+", "-", "*", "/", NULL
+};
+
+//reads a number or symbol at the read position, NULL if there isn't one
+static lval* lreader_atom(lreader* r){
+
+	//number: /-?[0-9]+/
+	long len = lreader_peek(r, 0) == '-' ? 1 : 0;
+	if(isdigit((unsigned char)lreader_peek(r, len))){
+		while(isdigit((unsigned char)lreader_peek(r, len))){ len++; }
+
+		//strtol stops at the end of the digits by itself
+		errno = 0;
+		long x = strtol(r->buf + r->pos, NULL, 10);
+		r->pos += len;
+		return errno != ERANGE ? lval_num(x) : lval_err("invalid_number");
+	}
+
+	//symbol
+	for(int i = 0; lreader_symbols[i]; i++){
+		if(lreader_match(r, lreader_symbols[i])){
+			r->pos += strlen(lreader_symbols[i]);
+			return lval_sym(lreader_symbols[i]);
+		}
+	}
+
+	return NULL;
+
+}
+
+lval* lreader_next(lreader* r){
+	if(r->error){ return NULL; }
+
+	//lists we are still in the middle of, innermost last
+	int depth = 0;
+	int max = 16;
+	lval** open = malloc(sizeof(lval*) * max);
+
+	lval* x = NULL;
+	while(!x){
+		lreader_skip(r);
+		char c = lreader_peek(r, 0);
+
+		//what the grammar would take here, used if c isn't any of it
+		char* expected = depth == 0 ? "number, symbol, '(', '{' or end of input"
+			: open[depth-1]->type == LVAL_SEXPR ? "number, symbol, '(', '{' or ')'"
+			: "number, symbol, '(', '{' or '}'";
+
+		lval* v = NULL;
+		if(c == '(' || c == '{'){
+			r->pos++;
+			if(depth == max){
+				max *= 2;
+				open = realloc(open, sizeof(lval*) * max);
+			}
+			open[depth++] = c == '(' ? lval_sexpr() : lval_qexpr();
+			continue;
+		}
+		else if(depth > 0 && c == (open[depth-1]->type == LVAL_SEXPR ? ')' : '}')){
+			r->pos++;
+			v = open[--depth];
+		}
+		else if(c == '\0' && depth == 0){
+			break;
+		}
+		else {
+			v = lreader_atom(r);
+		}
+
+		//nothing we know starts here, throw away what we have so far
+		if(!v){
+			x = lreader_err(r, expected);
+			while(depth > 0){ lval_del(open[--depth]); }
+			break;
+		}
+
+		if(depth == 0){
+			x = v;
+		} else {
+			open[depth-1] = lval_add(open[depth-1], v);
+		}
+	}
+
+	free(open);
+	return x;
+
+}
+
+
+/* READING WHOLE PROGRAMS */
+
+//reads every top level expression into one sexpr, like the '>' root node
+//the first syntax error replaces the whole program
+static lval* lreader_all(lreader* r){
+	lval* v = lval_sexpr();
+	lval* x;
+	while((x = lreader_next(r))){
+		if(r->error){
+			lval_del(v);
+			return x;
+		}
+		v = lval_add(v, x);
+	}
+	return v;
+
+}
+
+lval* lval_read_string(char* filename, char* s){
+	lreader* r = lreader_new_string(filename, s);
+	lval* v = lreader_all(r);
+	lreader_del(r);
+	return v;
+
+}
+
+lval* lval_read_file(char* filename, FILE* f){
+	lreader* r = lreader_new_file(filename, f);
+	lval* v = lreader_all(r);
+	lreader_del(r);
+	return v;
+
+}
@@ -0,0 +1,53 @@
+#ifndef Reader
+#define Reader
+
+#include "Lval.h"
+
+/* Reader type, reads lvals straight from the input bytes without going
+ through the mpc grammar and an mpc_ast_t tree */
+typedef struct lreader{
+	//name used in error messages, same as the filename given to mpc_parse
+	char* filename;
+
+	//input bytes and where we are in them
+	//a string reader borrows the caller's string, a file reader owns its
+	//buffer and only keeps the part of the file it hasn't finished with
+	char* buf;
+	int owned;
+	long len;
+	long pos;
+
+	//file being read in blocks, NULL for strings and once it has run out
+	FILE* file;
+	long size;
+
+	//row and col of buf[0], bytes already thrown away are counted in these
+	long row;
+	long col;
+
+	//set by a syntax error, nothing more gets read after one
+	int error;
+
+}lreader;
+
+/* Reader Constructors */
+//the string reader needs s to outlive it, the file reader doesn't close f
+lreader* lreader_new_string(char* filename, char* s);
+lreader* lreader_new_file(char* filename, FILE* f);
+
+/* Reader Deconstructor */
+void lreader_del(lreader* r);
+
+/* Reader Functions */
+//reads the next top level expression, NULL once the input is finished
+//syntax errors come back as a LVAL_ERR holding the error message
+//files are read as far as needed for the expression and no further, so
+//a script can be run one expression at a time without holding all of it
+lval* lreader_next(lreader* r);
+
+//reads the whole input into one sexpr, the same lval the jlispy grammar's
+//actions give
+lval* lval_read_string(char* filename, char* s);
+lval* lval_read_file(char* filename, FILE* f);
+
+#endif
@@ -0,0 +1,201 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "Lval.h"
+#include "Compile.h"
+#include "Reader.h"
+
+/*
+
+Compiler benchmark
+- times the same generated script run by the interpreter, reading it with
+  the reader and calling lval_eval on each form the way batch mode does,
+  against the C program lval_compile writes for it, built with cc
+- the script is a mix of nested arithmetic, division (some by zero) and
+  list builtins, made in memory so every run is the same
+- the errors printed are counted, the divisions by zero should be the
+  only ones, 1 in 35 forms
+- the compiled time is the whole process, so it includes starting it
+- both outputs are kept and compared, the best of a few runs is printed
+
+
+ build command, run it from src, it builds the compiled script with the
+ same Lval.c and mpc.c
+ cc -std=c99 -Wall -O2 compile_bench.c Lval.c Compile.c Reader.c mpc.c -lm -o compile_bench
+
+ ./compile_bench runs 5 runs of 20000 forms, ./compile_bench forms runs
+ changes the counts
+*/
+
+
+//files the bench writes next to itself, removed again at the end
+#define SCRIPT_C "compile_bench_script.c"
+#define SCRIPT_BIN "./compile_bench_script"
+#define INTERP_OUT "compile_bench_interp.out"
+#define COMPILED_OUT "compile_bench_compiled.out"
+
+//the script, n forms cycling through the kinds the compiler handles
+static char* make_script(int n){
+	char* s = malloc((long)n * 64 + 1);
+	char* c = s;
+	for(int k = 0; k < n; k++){
+		int a = k % 97, b = k % 13, d = k % 7;
+		switch(k % 5){
+			case 0: c += sprintf(c, "(+ %d (* %d %d) (- %d %d))\n", a, b, d, a, b); break;
+			case 1: c += sprintf(c, "(/ (* %d %d) %d)\n", a, a, d); break;
+			case 2: c += sprintf(c, "(- (+ 1 2 3 %d) (* 2 (- %d %d)))\n", a, b, d); break;
+			case 3: c += sprintf(c, "(eval (head {(+ %d %d) %d}))\n", a, b, d); break;
+			default: c += sprintf(c, "(join {%d %d} (tail {%d %d %d}))\n", a, b, d, a, b); break;
+		}
+	}
+	*c = '\0';
+	return s;
+
+}
+
+static double now(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+
+}
+
+//reads and runs the script with lval_eval, stdout goes to INTERP_OUT
+//returns the seconds it took, or -1 if it couldn't be read
+static double time_interp(char* script){
+	fflush(stdout);
+	FILE* out = fopen(INTERP_OUT, "wb");
+	if(!out){ return -1; }
+	int saved = dup(1);
+	dup2(fileno(out), 1);
+	fclose(out);
+
+	double start = now();
+	lval* x = lval_read_string("<bench>", script);
+	int ok = x->type != LVAL_ERR;
+	if(ok){
+		//lval_eval takes each cell, so x is left with nothing to free in it
+		for(int i = 0; i < x->count; i++){
+			lval* y = lval_eval(x->cell[i]);
+			lval_println(y);
+			lval_del(y);
+		}
+		x->count = 0;
+	}
+	lval_del(x);
+	fflush(stdout);
+	double t = now() - start;
+
+	dup2(saved, 1);
+	close(saved);
+	return ok ? t : -1;
+
+}
+
+//runs the compiled script, stdout goes to COMPILED_OUT
+static double time_compiled(void){
+	double start = now();
+	int status = system(SCRIPT_BIN " > " COMPILED_OUT);
+	double t = now() - start;
+	return status == 0 ? t : -1;
+
+}
+
+//writes the script out as C and builds it, returns 0 if anything failed
+static int build(char* script){
+	lval* x = lval_read_string("<bench>", script);
+	if(x->type == LVAL_ERR){
+		fprintf(stderr, "%s\n", x->err);
+		lval_del(x);
+		return 0;
+	}
+
+	FILE* f = fopen(SCRIPT_C, "wb");
+	if(!f){
+		lval_del(x);
+		fprintf(stderr, "%s: error: Unable to open file!\n", SCRIPT_C);
+		return 0;
+	}
+	lval_compile(x, "<bench>", f);
+	fclose(f);
+	lval_del(x);
+
+	return system("cc -std=c99 -O2 " SCRIPT_C " Lval.c mpc.c -lm -o " SCRIPT_BIN) == 0;
+
+}
+
+//counts the errors lval_eval printed
+static int count_errors(void){
+	FILE* f = fopen(INTERP_OUT, "rb");
+	if(!f){ return -1; }
+	char line[256];
+	int n = 0;
+	while(fgets(line, sizeof(line), f)){
+		if(strncmp(line, "Error: ", 7) == 0){ n++; }
+	}
+	fclose(f);
+	return n;
+
+}
+
+//checks the two outputs are byte for byte the same
+static int same_output(void){
+	FILE* a = fopen(INTERP_OUT, "rb");
+	FILE* b = fopen(COMPILED_OUT, "rb");
+	int same = a && b;
+	while(same){
+		int ca = fgetc(a), cb = fgetc(b);
+		if(ca != cb){ same = 0; }
+		if(ca == EOF || cb == EOF){ break; }
+	}
+	if(a){ fclose(a); }
+	if(b){ fclose(b); }
+	return same;
+
+}
+
+int main(int argc, char** argv){
+	int forms = argc > 1 ? atoi(argv[1]) : 20000;
+	int runs = argc > 2 ? atoi(argv[2]) : 5;
+	if(forms <= 0){ forms = 1; }
+	if(runs <= 0){ runs = 1; }
+
+	char* script = make_script(forms);
+	if(!build(script)){
+		free(script);
+		fprintf(stderr, "error: Unable to build the compiled script!\n");
+		return 1;
+	}
+
+	double interp = -1, compiled = -1;
+	for(int r = 0; r < runs; r++){
+		double t = time_interp(script);
+		if(t < 0){ break; }
+		if(interp < 0 || t < interp){ interp = t; }
+
+		t = time_compiled();
+		if(t < 0){ break; }
+		if(compiled < 0 || t < compiled){ compiled = t; }
+	}
+	int same = same_output();
+	int errors = count_errors();
+	free(script);
+
+	remove(SCRIPT_C);
+	remove(SCRIPT_BIN + 2);
+	remove(INTERP_OUT);
+	remove(COMPILED_OUT);
+	if(interp < 0 || compiled < 0){ return 1; }
+
+	printf("forms:            %d\n", forms);
+	printf("lval_eval:        %.4fs\n", interp);
+	printf("compiled:         %.4fs\n", compiled);
+	printf("speedup:          %.1fx\n", compiled > 0 ? interp / compiled : 0);
+	printf("same output:      %s\n", same ? "yes" : "no");
+	printf("errors:           %d\n", errors);
+	return same ? 0 : 1;
+
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "mpc.h"
+
+/*
+
+Grammar startup benchmark
+- times building the jlispy grammar from its text with mpca_lang against
+  loading the same parsers from a saved image with mpca_lang_image, which is
+  what ./parsing -g does at startup
+- each build makes the parsers, builds them and cleans them up again, the way
+  a short lived process would
+- prints the average time of one build each way
+
+
+ build command
+ cc -std=c99 -Wall -O2 grammar_bench.c mpc.c -lm -o grammar_bench
+
+ ./grammar_bench runs 2000 builds each way, ./grammar_bench n runs n
+*/
+
+
+//same grammar as parsing.c, without the actions
+static const char* grammar =
+	"                                                              \
+	number   : /-?[0-9]+/ ;                                        \
+	symbol   : \"list\" | \"head\" | \"tail\"                      \
+	         | \"join\" | \"eval\" | '+' | '-' | '*' | '/' ;       \
+	sexpr    : '('<expr>*')';                                      \
+	qexpr    : '{' <expr>* '}' ;                                   \
+	expr     : <number> | <symbol> | <sexpr> | <qexpr>;            \
+	jlispy   : /^/ <expr>* /$/ ;                                   \
+	";
+
+//the image read back into memory, as if it were compiled in with xxd -i
+static char* image;
+static size_t image_len;
+
+//builds the grammar once, from the image if from_image is set
+//saves the image instead if save is set, returns 0 if anything failed
+static int build(int from_image, int save){
+	mpc_parser_t* Number = mpc_new("number");
+	mpc_parser_t* Symbol = mpc_new("symbol");
+	mpc_parser_t* Sexpr = mpc_new("sexpr");
+	mpc_parser_t* Qexpr = mpc_new("qexpr");
+	mpc_parser_t* Expr = mpc_new("expr");
+	mpc_parser_t* Jlispy = mpc_new("jlispy");
+
+	mpc_err_t* err = from_image
+		? mpca_lang_image(image, image_len, NULL, NULL, 6, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy)
+		: mpca_lang(MPCA_LANG_DEFAULT, grammar, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy, NULL);
+
+	FILE* f = !err && save ? tmpfile() : NULL;
+	if(f){
+		err = mpca_lang_save(f, 6, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy);
+		if(!err){
+			image_len = ftell(f);
+			image = malloc(image_len);
+			rewind(f);
+			image_len = fread(image, 1, image_len, f);
+		}
+		fclose(f);
+	}
+
+	mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy);
+	if(err){
+		mpc_err_print(err);
+		mpc_err_delete(err);
+		return 0;
+	}
+	if(save && !image){
+		fprintf(stderr, "error: Unable to save the image!\n");
+		return 0;
+	}
+	return 1;
+
+}
+
+//average microseconds of one build over n builds
+static double time_builds(int from_image, int n){
+	clock_t start = clock();
+	for(int i = 0; i < n; i++){
+		if(!build(from_image, 0)){ return -1; }
+	}
+	return (double)(clock() - start) / CLOCKS_PER_SEC * 1e6 / n;
+
+}
+
+int main(int argc, char** argv){
+	int n = argc > 1 ? atoi(argv[1]) : 2000;
+	if(n <= 0){ n = 1; }
+
+	if(!build(0, 1)){ return 1; }
+
+	double text = time_builds(0, n);
+	double img = time_builds(1, n);
+	free(image);
+	if(text < 0 || img < 0){ return 1; }
+
+	printf("image size:       %lu bytes\n", (unsigned long)image_len);
+	printf("mpca_lang:        %.1fus\n", text);
+	printf("mpca_lang_image:  %.1fus\n", img);
+	printf("speedup:          %.1fx\n", img > 0 ? text / img : 0);
+	return 0;
+
+}
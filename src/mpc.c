@@ -1,5 +1,14 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "mpc.h"
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 /*
 ** State Type
 */
@@ -20,16 +29,26 @@ static mpc_state_t mpc_state_new(void) {
   return s;
 }
 
+static mpc_state_t mpc_state_pos(long pos) {
+  mpc_state_t s;
+  s.pos = pos;
+  s.row = 0;
+  s.col = 0;
+  return s;
+}
+
 /*
 ** Input Type
 */
 
 /*
-** In mpc the input type has three modes of 
-** operation: String, File and Pipe.
+** In mpc the input type has four modes of 
+** operation: String, File, Pipe and Mmap.
 **
-** String is easy. The whole contents are 
-** loaded into a buffer and scanned through.
+** String is easy. The caller's buffer is
+** borrowed, not copied, and scanned through.
+** Its length is worked out once so bounds
+** checks don't have to look for the end.
 ** The cursor can jump around at will making 
 ** backtracking easy.
 **
@@ -47,7 +66,17 @@ static mpc_state_t mpc_state_new(void) {
 **
 ** This means that if we are requested to seek
 ** back we can simply start reading from the
-** buffer instead of the input.
+** buffer instead of the input. The buffer 
+** doubles when it fills up, throwing away 
+** anything behind the oldest mark first, so
+** it only ever holds what might be rewound.
+**
+** Mmap maps a File into memory so it can be
+** treated like a String without copying it.
+** Peeks are plain loads and backtracking is 
+** just moving the cursor. Anything that can't
+** be mapped, such as a pipe, is read into a
+** buffer in big blocks instead.
 **
 ** Of course using `mpc_predictive` will disable
 ** backtracking and make LL(1) grammars easy
@@ -58,43 +87,140 @@ static mpc_state_t mpc_state_new(void) {
 enum {
   MPC_INPUT_STRING = 0,
   MPC_INPUT_FILE   = 1,
-  MPC_INPUT_PIPE   = 2
+  MPC_INPUT_PIPE   = 2,
+  MPC_INPUT_MMAP   = 3
+};
+
+enum {
+  MPC_INPUT_MARKS_MIN = 32,
+  MPC_INPUT_LINES_MIN = 64
 };
 
 enum {
-  MPC_INPUT_MARKS_MIN = 32
+  MPC_INPUT_MEM_CLASSES = 3,
+  MPC_INPUT_MEM_SMALL = 16,
+  MPC_INPUT_MEM_SPAN = 2,
+  MPC_INPUT_MEM_MIN = 256,
+  MPC_INPUT_MEM_MAX = 4096
 };
 
 enum {
-  MPC_INPUT_MEM_NUM = 512
+  MPC_INPUT_BUFFER_MIN = 4096
 };
 
+enum {
+  MPC_INPUT_MEMO_NUM = 1024,
+  MPC_INPUT_MEMO_BYTES = 4194304,
+  MPC_INPUT_REASKED_NUM = 64,
+  MPC_INPUT_SKIP_NUM = 256
+};
+
+typedef struct {
+  mpc_parser_t *p;
+  long pos;
+  char start_last;
+  int success;
+  int errors;
+  int kept;
+  long end;
+  char last;
+  mpc_val_t *output;
+  mpc_err_t *error;
+  mpc_err_t *merged;
+  size_t bytes;
+} mpc_memo_t;
+
+typedef struct {
+  mpc_parser_t *p;
+  int j;
+  mpc_err_t *error;
+} mpc_skip_t;
+
+/*
+** Each input has a pool of small blocks in three
+** size classes of 16, 32 and 64 bytes, laid out one
+** after another in a single allocation so that a
+** pointer can be told apart from a `malloc`ed one by
+** its address. Blocks are handed out from a bump
+** pointer and freed ones are kept in a list per class,
+** with the link stored in the block itself.
+*/
+
+typedef struct {
+  long pos;
+  char last;
+} mpc_mark_t;
+
 typedef struct {
-  char mem[64];
+  char *block;
+  char *end;
+  char *next[MPC_INPUT_MEM_CLASSES];
+  char *last[MPC_INPUT_MEM_CLASSES];
+  void *free[MPC_INPUT_MEM_CLASSES];
+  mpc_mem_stats_t stats;
 } mpc_mem_t;
 
+/*
+** The totals over every input are shared by all
+** parses, so they are only kept with MPC_STATS.
+** Without it each input counts for itself alone.
+*/
+
+#ifdef MPC_STATS
+static int mpc_mem_blocks = MPC_INPUT_MEM_MAX;
+static mpc_mem_stats_t mpc_mem_totals;
+static mpc_or_stats_t mpc_or_totals;
+#define MPC_INPUT_MEM_BLOCKS mpc_mem_blocks
+#else
+#define MPC_INPUT_MEM_BLOCKS MPC_INPUT_MEM_MAX
+#endif
+
 typedef struct {
 
   int type;
   char *filename;  
-  mpc_state_t state;
+  long pos;
   
   char *string;
   char *buffer;
   FILE *file;
   
+  long length;
+  void *map;
+  size_t map_length;
+  
+  long buffer_start;
+  long buffer_len;
+  long buffer_size;
+  
+  mpc_memo_t *memo;
+  size_t memo_bytes;
+  mpc_parser_t **reasked;
+  mpc_skip_t *skips;
+  mpc_ast_arena_t *arena;
+  
+  char **labels;
+  int labels_num;
+  int labels_slots;
+  
+  long *lines;
+  int lines_num;
+  int lines_slots;
+  int line;
+  long lines_end;
+  
   int suppress;
+  int aborted;
   int backtrack;
+  int spanning;
   int marks_slots;
   int marks_num;
-  mpc_state_t *marks;
+  mpc_mark_t *marks;
   
-  char *lasts;
   char last;
   
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
-  mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+  mpc_mem_t mem;
+  mpc_or_stats_t or_stats;
   
 } mpc_input_t;
 
@@ -106,53 +232,102 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   strcpy(i->filename, filename);
   i->type = MPC_INPUT_STRING;
   
-  i->state = mpc_state_new();
+  i->pos = 0;
   
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
+  i->string = (char*)string;
   i->buffer = NULL;
   i->file = NULL;
   
+  i->length = strlen(string);
+  i->map = NULL;
+  i->map_length = 0;
+  
+  i->buffer_start = 0;
+  i->buffer_len = 0;
+  i->buffer_size = 0;
+  
+  i->memo = NULL;
+  i->reasked = NULL;
+  i->skips = NULL;
+  i->arena = NULL;
+  memset(&i->or_stats, 0, sizeof(mpc_or_stats_t));
+  
+  i->labels = NULL;
+  i->labels_num = 0;
+  i->labels_slots = 0;
+  
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->line = 0;
+  i->lines_end = 0;
+  
   i->suppress = 0;
+  i->aborted = 0;
+  i->spanning = 0;
   i->backtrack = 1;
   i->marks_num = 0;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->marks = malloc(sizeof(mpc_mark_t) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  memset(&i->mem, 0, sizeof(mpc_mem_t));
   
   return i;
 }
 
 static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *string, size_t length) {
 
+  const char *end;
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
   
   i->filename = malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
   i->type = MPC_INPUT_STRING;
   
-  i->state = mpc_state_new();
+  i->pos = 0;
+  
+  /* Stops at a null byte like a copy would */
+  end = memchr(string, '\0', length);
   
-  i->string = malloc(length + 1);
-  strncpy(i->string, string, length);
-  i->string[length] = '\0';
+  i->string = (char*)string;
   i->buffer = NULL;
   i->file = NULL;
   
+  i->length = end ? end - string : (long)length;
+  i->map = NULL;
+  i->map_length = 0;
+  
+  i->buffer_start = 0;
+  i->buffer_len = 0;
+  i->buffer_size = 0;
+  
+  i->memo = NULL;
+  i->reasked = NULL;
+  i->skips = NULL;
+  i->arena = NULL;
+  memset(&i->or_stats, 0, sizeof(mpc_or_stats_t));
+  
+  i->labels = NULL;
+  i->labels_num = 0;
+  i->labels_slots = 0;
+  
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->line = 0;
+  i->lines_end = 0;
+  
   i->suppress = 0;
+  i->aborted = 0;
+  i->spanning = 0;
   i->backtrack = 1;
   i->marks_num = 0;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->marks = malloc(sizeof(mpc_mark_t) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  memset(&i->mem, 0, sizeof(mpc_mem_t));
   
   return i;
 
@@ -166,22 +341,46 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   strcpy(i->filename, filename);
   
   i->type = MPC_INPUT_PIPE;
-  i->state = mpc_state_new();
+  i->pos = 0;
   
   i->string = NULL;
   i->buffer = NULL;
   i->file = pipe;
   
+  i->length = 0;
+  i->map = NULL;
+  i->map_length = 0;
+  
+  i->buffer_start = 0;
+  i->buffer_len = 0;
+  i->buffer_size = 0;
+  
+  i->memo = NULL;
+  i->reasked = NULL;
+  i->skips = NULL;
+  i->arena = NULL;
+  memset(&i->or_stats, 0, sizeof(mpc_or_stats_t));
+  
+  i->labels = NULL;
+  i->labels_num = 0;
+  i->labels_slots = 0;
+  
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->line = 0;
+  i->lines_end = 0;
+  
   i->suppress = 0;
+  i->aborted = 0;
+  i->spanning = 0;
   i->backtrack = 1;
   i->marks_num = 0;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->marks = malloc(sizeof(mpc_mark_t) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  memset(&i->mem, 0, sizeof(mpc_mem_t));
   
   return i;
   
@@ -194,62 +393,257 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->filename = malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
   i->type = MPC_INPUT_FILE;
-  i->state = mpc_state_new();
+  i->pos = 0;
   
   i->string = NULL;
   i->buffer = NULL;
   i->file = file;
   
+  i->length = 0;
+  i->map = NULL;
+  i->map_length = 0;
+  
+  i->buffer_start = 0;
+  i->buffer_len = 0;
+  i->buffer_size = 0;
+  
+  i->memo = NULL;
+  i->reasked = NULL;
+  i->skips = NULL;
+  i->arena = NULL;
+  memset(&i->or_stats, 0, sizeof(mpc_or_stats_t));
+  
+  i->labels = NULL;
+  i->labels_num = 0;
+  i->labels_slots = 0;
+  
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->line = 0;
+  i->lines_end = 0;
+  
+  i->suppress = 0;
+  i->aborted = 0;
+  i->spanning = 0;
+  i->backtrack = 1;
+  i->marks_num = 0;
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(mpc_mark_t) * i->marks_slots);
+  i->last = '\0';
+  
+  memset(&i->mem, 0, sizeof(mpc_mem_t));
+  
+  return i;
+}
+
+static mpc_input_t *mpc_input_new_mmap(const char *filename, FILE *file) {
+  
+  long start = ftell(file);
+  size_t n, max;
+  
+  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  
+  i->filename = malloc(strlen(filename) + 1);
+  strcpy(i->filename, filename);
+  i->type = MPC_INPUT_MMAP;
+  i->pos = 0;
+  
+  i->string = NULL;
+  i->buffer = NULL;
+  i->file = NULL;
+  
+  i->length = 0;
+  i->map = NULL;
+  i->map_length = 0;
+  
+  i->buffer_start = 0;
+  i->buffer_len = 0;
+  i->buffer_size = 0;
+  
+  i->memo = NULL;
+  i->reasked = NULL;
+  i->skips = NULL;
+  i->arena = NULL;
+  memset(&i->or_stats, 0, sizeof(mpc_or_stats_t));
+  
+  i->labels = NULL;
+  i->labels_num = 0;
+  i->labels_slots = 0;
+  
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->line = 0;
+  i->lines_end = 0;
+  
+#ifndef _WIN32
+  {
+    struct stat st;
+    if (start >= 0
+    &&  fstat(fileno(file), &st) == 0
+    &&  S_ISREG(st.st_mode) && st.st_size > start) {
+      i->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+      if (i->map == MAP_FAILED) {
+        i->map = NULL;
+      } else {
+        i->map_length = st.st_size;
+        i->string = (char*)i->map + start;
+        i->length = st.st_size - start;
+      }
+    }
+  }
+#endif
+  
+  /* Not mappable, read the rest of it in big blocks */
+  if (i->map == NULL) {
+    max = 4096;
+    i->string = malloc(max);
+    while ((n = fread(i->string + i->length, 1, max - i->length, file)) > 0) {
+      i->length += n;
+      if ((size_t)i->length == max) {
+        max *= 2;
+        i->string = realloc(i->string, max);
+      }
+    }
+  }
+  
   i->suppress = 0;
+  i->aborted = 0;
+  i->spanning = 0;
   i->backtrack = 1;
   i->marks_num = 0;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->marks = malloc(sizeof(mpc_mark_t) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  memset(&i->mem, 0, sizeof(mpc_mem_t));
   
   return i;
 }
 
+static void mpc_input_memo_delete(mpc_input_t *i);
+static void mpc_input_skips_delete(mpc_input_t *i);
+static void mpc_input_labels_delete(mpc_input_t *i);
+static mpc_ast_arena_t *mpc_ast_arena_new(void);
+static void mpc_ast_arena_delete(mpc_ast_arena_t *m);
+static void mpc_ast_arena_finish(mpc_ast_arena_t *m, mpc_val_t *x);
+static mpc_ast_t *mpc_ast_new_in(mpc_ast_arena_t *m, const char *tag, const char *contents);
+static mpc_ast_t *mpc_ast_share(mpc_ast_t *a);
+
+static void mpc_input_mem_delete(mpc_input_t *i);
+
 static void mpc_input_delete(mpc_input_t *i) {
   
   free(i->filename);
   
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
+  if (i->memo) { mpc_input_memo_delete(i); }
+  if (i->skips) { mpc_input_skips_delete(i); }
+  if (i->arena) { mpc_ast_arena_delete(i->arena); }
+  if (i->labels) { mpc_input_labels_delete(i); }
+  
+#ifdef MPC_STATS
+  mpc_or_totals.ors += i->or_stats.ors;
+  mpc_or_totals.tried += i->or_stats.tried;
+  mpc_or_totals.skipped += i->or_stats.skipped;
+#endif
+  
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+  if (i->type == MPC_INPUT_MMAP && !i->map) { free(i->string); }
+#ifndef _WIN32
+  if (i->type == MPC_INPUT_MMAP && i->map) { munmap(i->map, i->map_length); }
+#endif
   
   free(i->marks);
-  free(i->lasts);
+  free(i->lines);
+  mpc_input_mem_delete(i);
   free(i);
 }
 
+static void mpc_input_mem_init(mpc_input_t *i) {
+  
+  mpc_mem_t *m = &i->mem;
+  long n = i->length / MPC_INPUT_MEM_SPAN;
+  char *p;
+  int c;
+  
+  if (n < MPC_INPUT_MEM_MIN) { n = MPC_INPUT_MEM_MIN; }
+  if (n > MPC_INPUT_MEM_BLOCKS) { n = MPC_INPUT_MEM_BLOCKS; }
+  
+  m->block = malloc((size_t)n * MPC_INPUT_MEM_SMALL * ((1 << MPC_INPUT_MEM_CLASSES) - 1));
+  
+  p = m->block;
+  for (c = 0; c < MPC_INPUT_MEM_CLASSES; c++) {
+    m->next[c] = p;
+    p += (size_t)n * (MPC_INPUT_MEM_SMALL << c);
+    m->last[c] = p;
+  }
+  m->end = p;
+}
+
+static void mpc_input_mem_delete(mpc_input_t *i) {
+  
+  mpc_mem_t *m = &i->mem;
+  char *p = m->block;
+  int c;
+  
+  /* Freed blocks are reused first, so the bump pointers mark the peak */
+  for (c = 0; c < MPC_INPUT_MEM_CLASSES && m->block; c++) {
+    m->stats.peak += (m->next[c] - p) / (MPC_INPUT_MEM_SMALL << c);
+    p = m->last[c];
+  }
+  
+#ifdef MPC_STATS
+  mpc_mem_totals.hits += m->stats.hits;
+  mpc_mem_totals.fallbacks += m->stats.fallbacks;
+  mpc_mem_totals.exhausted += m->stats.exhausted;
+  if (m->stats.peak > mpc_mem_totals.peak) {
+    mpc_mem_totals.peak = m->stats.peak;
+  }
+#endif
+  
+  free(m->block);
+}
+
 static int mpc_mem_ptr(mpc_input_t *i, void *p) {
-  return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+  return (char*)p >= i->mem.block && (char*)p < i->mem.end;
+}
+
+static int mpc_mem_class(mpc_input_t *i, void *p) {
+  int c = 0;
+  while ((char*)p >= i->mem.last[c]) { c++; }
+  return c;
 }
 
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
-  char *p;
   
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
+  mpc_mem_t *m = &i->mem;
+  void *p;
+  int c;
   
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
-    }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+  if      (n <= MPC_INPUT_MEM_SMALL * 1) { c = 0; }
+  else if (n <= MPC_INPUT_MEM_SMALL * 2) { c = 1; }
+  else if (n <= MPC_INPUT_MEM_SMALL * 4) { c = 2; }
+  else {
+    m->stats.fallbacks++;
+    return malloc(n);
+  }
   
-  return malloc(n);
+  if (m->block == NULL) { mpc_input_mem_init(i); }
+  
+  if (m->free[c]) {
+    p = m->free[c];
+    m->free[c] = *(void**)p;
+  } else if (m->next[c] < m->last[c]) {
+    p = m->next[c];
+    m->next[c] += MPC_INPUT_MEM_SMALL << c;
+  } else {
+    m->stats.exhausted++;
+    return malloc(n);
+  }
+  
+  m->stats.hits++;
+  return p;
 }
 
 static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
@@ -259,21 +653,25 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 }
 
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
+  int c;
   if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  c = mpc_mem_class(i, p);
+  *(void**)p = i->mem.free[c];
+  i->mem.free[c] = p;
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
   
+  size_t m;
   char *q = NULL;
   
   if (!mpc_mem_ptr(i, p)) { return realloc(p, n); }
   
-  if (n > sizeof(mpc_mem_t)) {
-    q = malloc(n);
-    memcpy(q, p, sizeof(mpc_mem_t));
+  m = MPC_INPUT_MEM_SMALL << mpc_mem_class(i, p);
+  
+  if (n > m) {
+    q = mpc_malloc(i, n);
+    memcpy(q, p, m);
     mpc_free(i, p);
     return q;
   }
@@ -282,10 +680,12 @@ static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
 }
 
 static void *mpc_export(mpc_input_t *i, void *p) {
+  size_t m;
   char *q = NULL;
   if (!mpc_mem_ptr(i, p)) { return p; }
-  q = malloc(sizeof(mpc_mem_t));
-  memcpy(q, p, sizeof(mpc_mem_t));
+  m = MPC_INPUT_MEM_SMALL << mpc_mem_class(i, p);
+  q = malloc(m);
+  memcpy(q, p, m);
   mpc_free(i, p);
   return q; 
 }
@@ -296,24 +696,27 @@ static void mpc_input_backtrack_enable(mpc_input_t *i) { i->backtrack++; }
 static void mpc_input_suppress_disable(mpc_input_t *i) { i->suppress--; }
 static void mpc_input_suppress_enable(mpc_input_t *i) { i->suppress++; }
 
+/*
+** Marks are a stack that only ever grows, keeping
+** the deepest nesting seen for the rest of the
+** parse, so marking is a store and unmarking a
+** decrement.
+*/
+
 static void mpc_input_mark(mpc_input_t *i) {
   
-  if (i->backtrack < 1) { return; }
+  mpc_mark_t *m;
   
-  i->marks_num++;
+  if (i->backtrack < 1) { return; }
   
-  if (i->marks_num > i->marks_slots) {
-    i->marks_slots = i->marks_num + i->marks_num / 2;
-    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
-    i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
+  if (i->marks_num == i->marks_slots) {
+    i->marks_slots *= 2;
+    i->marks = realloc(i->marks, sizeof(mpc_mark_t) * i->marks_slots);
   }
-
-  i->marks[i->marks_num-1] = i->state;
-  i->lasts[i->marks_num-1] = i->last;
   
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
+  m = &i->marks[i->marks_num++];
+  m->pos = i->pos;
+  m->last = i->last;
   
 }
 
@@ -323,18 +726,11 @@ static void mpc_input_unmark(mpc_input_t *i) {
   
   i->marks_num--;
   
-  if (i->marks_slots > i->marks_num + i->marks_num / 2
-  &&  i->marks_slots > MPC_INPUT_MARKS_MIN) {
-    i->marks_slots = 
-      i->marks_num > MPC_INPUT_MARKS_MIN ?
-      i->marks_num : MPC_INPUT_MARKS_MIN;
-    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
-    i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);      
-  }
-  
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    free(i->buffer);
-    i->buffer = NULL;
+  /* Nothing left to rewind to, unless we are still reading back a rewind */
+  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0
+  &&  i->pos >= i->buffer_start + i->buffer_len) {
+    i->buffer_start = i->pos;
+    i->buffer_len = 0;
   }
   
 }
@@ -343,44 +739,93 @@ static void mpc_input_rewind(mpc_input_t *i) {
   
   if (i->backtrack < 1) { return; }
   
-  i->state = i->marks[i->marks_num-1];
-  i->last  = i->lasts[i->marks_num-1];
+  i->pos = i->marks[i->marks_num-1].pos;
+  i->last  = i->marks[i->marks_num-1].last;
   
   if (i->type == MPC_INPUT_FILE) {
-    fseek(i->file, i->state.pos, SEEK_SET);
+    fseek(i->file, i->pos, SEEK_SET);
   }
   
   mpc_input_unmark(i);
 }
 
 static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
+  return i->pos >= i->buffer_start
+    &&   i->pos < i->buffer_start + i->buffer_len;
 }
 
 static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
+  return i->buffer[i->pos - i->buffer_start];
+}
+
+static void mpc_input_buffer_push(mpc_input_t *i, char c) {
+  
+  long drop;
+  
+  /* Characters read with no marks weren't kept, start again from here */
+  if (i->pos != i->buffer_start + i->buffer_len) {
+    i->buffer_start = i->pos;
+    i->buffer_len = 0;
+  }
+  
+  if (i->buffer_len == i->buffer_size) {
+    
+    /* Everything before the oldest mark can't be rewound to any more */
+    drop = i->marks[0].pos - i->buffer_start;
+    if (drop > 0) {
+      memmove(i->buffer, i->buffer + drop, i->buffer_len - drop);
+      i->buffer_start += drop;
+      i->buffer_len -= drop;
+    }
+    
+    if (i->buffer_len > i->buffer_size / 2 || i->buffer_size == 0) {
+      i->buffer_size = i->buffer_size ? i->buffer_size * 2 : MPC_INPUT_BUFFER_MIN;
+      i->buffer = realloc(i->buffer, i->buffer_size);
+    }
+  }
+  
+  i->buffer[i->buffer_len++] = c;
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->pos == i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
-  if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
+  if (i->type == MPC_INPUT_PIPE && feof(i->file) && !mpc_input_buffer_in_range(i)) { return 1; }
+  if (i->type == MPC_INPUT_MMAP && i->pos == i->length) { return 1; }
   return 0;
 }
 
+/*
+** Character classes are kept as a bit per byte.
+** Like the `strchr` they stand in for, `oneof`
+** takes the null character too and `noneof`
+** doesn't.
+*/
+
+static int mpc_class_has(const unsigned char *set, char c) {
+  return (set[(unsigned char)c / 8] >> ((unsigned char)c % 8)) & 1;
+}
+
+static void mpc_class_init(unsigned char *set, const char *s, int none) {
+  int j;
+  memset(set, 0, 32);
+  set[0] = 1;
+  for (; *s; s++) { set[(unsigned char)*s / 8] |= 1 << ((unsigned char)*s % 8); }
+  if (none) { for (j = 0; j < 32; j++) { set[j] = ~set[j]; } }
+}
+
 static char mpc_input_getc(mpc_input_t *i) {
   
   char c = '\0';
   
   switch (i->type) {
     
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP: return i->pos < i->length ? i->string[i->pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
     
-      if (!i->buffer) { c = getc(i->file); return c; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         c = mpc_input_buffer_get(i);
         return c;
       } else {
@@ -397,7 +842,8 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
   
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP: return i->pos < i->length ? i->string[i->pos] : '\0';
     case MPC_INPUT_FILE: 
       
       c = fgetc(i->file);
@@ -408,14 +854,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
     
     case MPC_INPUT_PIPE:
       
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         return mpc_input_buffer_get(i);
       } else {
         c = getc(i->file);
@@ -433,12 +872,11 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
 
   switch (i->type) {
     case MPC_INPUT_STRING: { break; }
+    case MPC_INPUT_MMAP: { break; }
     case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
     case MPC_INPUT_PIPE: {
       
-      if (!i->buffer) { ungetc(c, i->file); break; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         break;
       } else {
         ungetc(c, i->file); 
@@ -449,24 +887,88 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
   return 0;
 }
 
-static int mpc_input_success(mpc_input_t *i, char c, char **o) {
+/*
+** Only the position is kept while parsing. Rows
+** and columns are worked out from an index of
+** where each line starts, built only once a state
+** is asked for. Strings and mmaps are searched up
+** to there on demand, but files and pipes may not
+** be read again, so their newlines are noted down
+** the first time they are read.
+*/
+
+static void mpc_input_lines_add(mpc_input_t *i, long start) {
+  if (i->lines_num == i->lines_slots) {
+    i->lines_slots = i->lines_slots ? i->lines_slots * 2 : MPC_INPUT_LINES_MIN;
+    i->lines = realloc(i->lines, sizeof(long) * i->lines_slots);
+  }
+  i->lines[i->lines_num++] = start;
+}
+
+static void mpc_input_lines_read(mpc_input_t *i, char c) {
+  if (i->pos < i->lines_end) { return; }
+  if (c == '\n') { mpc_input_lines_add(i, i->pos + 1); }
+  i->lines_end = i->pos + 1;
+}
+
+static void mpc_input_lines_index(mpc_input_t *i, long pos) {
+  
+  const char *n;
+  
+  if (i->type != MPC_INPUT_STRING && i->type != MPC_INPUT_MMAP) { return; }
+  if (pos > i->length) { pos = i->length; }
+  
+  while (i->lines_end < pos) {
+    n = memchr(i->string + i->lines_end, '\n', pos - i->lines_end);
+    if (n == NULL) { i->lines_end = pos; break; }
+    i->lines_end = (n - i->string) + 1;
+    mpc_input_lines_add(i, i->lines_end);
+  }
+}
+
+static mpc_state_t mpc_input_state_at(mpc_input_t *i, long pos) {
+  
+  mpc_state_t s;
+  int lo, hi, r;
+  
+  s.pos = pos;
+  if (pos < 0) { s.row = -1; s.col = -1; return s; }
+  
+  mpc_input_lines_index(i, pos);
+  
+  /* States mostly come in order, so look on the line of the last first */
+  r = i->line < i->lines_num ? i->line : i->lines_num;
+  while (r < i->lines_num && i->lines[r] <= pos && r < i->line + 2) { r++; }
   
-  if (i->type == MPC_INPUT_PIPE
-  &&  i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
+  if ((r > 0 && i->lines[r-1] > pos) || (r < i->lines_num && i->lines[r] <= pos)) {
+    lo = 0; hi = i->lines_num;
+    while (lo < hi) {
+      r = lo + (hi - lo) / 2;
+      if (i->lines[r] <= pos) { lo = r + 1; } else { hi = r; }
+    }
+    r = lo;
   }
   
-  i->last = c;
-  i->state.pos++;
-  i->state.col++;
+  i->line = r;
+  s.row = r;
+  s.col = pos - (r > 0 ? i->lines[r-1] : 0);
+  return s;
+}
+
+static int mpc_input_success(mpc_input_t *i, char c, char **o) {
+  
+  if (i->type == MPC_INPUT_PIPE && i->marks_num > 0
+  &&  !mpc_input_buffer_in_range(i)) {
+    mpc_input_buffer_push(i, c);
+  }
   
-  if (c == '\n') {
-    i->state.col = 0;
-    i->state.row++;
+  if (i->type == MPC_INPUT_FILE || i->type == MPC_INPUT_PIPE) {
+    mpc_input_lines_read(i, c);
   }
   
+  i->last = c;
+  i->pos++;
+  
   if (o) {
     (*o) = mpc_malloc(i, 2);
     (*o)[0] = c;
@@ -494,16 +996,89 @@ static int mpc_input_range(mpc_input_t *i, char c, char d, char **o) {
   return x >= c && x <= d ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
-static int mpc_input_oneof(mpc_input_t *i, const char *c, char **o) {
+static int mpc_input_class(mpc_input_t *i, const unsigned char *set, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return mpc_class_has(set, x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
-static int mpc_input_noneof(mpc_input_t *i, const char *c, char **o) {
-  char x = mpc_input_getc(i);
-  if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+/* Moves a string or mmap input on to `end` */
+
+static void mpc_input_advance(mpc_input_t *i, long end) {
+  if (end > i->pos) { i->last = i->string[end-1]; }
+  i->pos = end;
+}
+
+/*
+** Reads the whole run of characters in `set`
+** from here in one go and returns how many there
+** were. Strings and mmaps are scanned in place.
+** Nothing is copied out if `o` is NULL.
+*/
+
+static long mpc_input_span(mpc_input_t *i, const unsigned char *set, char **o) {
+  
+  long j, n = 0, slots = 16;
+  char x;
+  
+  if (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP) {
+    for (j = i->pos; j < i->length; j++) {
+      if (!mpc_class_has(set, i->string[j])) { break; }
+    }
+    n = j - i->pos;
+    if (o) {
+      *o = mpc_malloc(i, n + 1);
+      memcpy(*o, i->string + i->pos, n);
+      (*o)[n] = '\0';
+    }
+    mpc_input_advance(i, j);
+    return n;
+  }
+  
+  if (o) { *o = mpc_malloc(i, slots); }
+  
+  while (1) {
+    x = mpc_input_getc(i);
+    if (mpc_input_terminated(i)) { break; }
+    if (!mpc_class_has(set, x)) { mpc_input_failure(i, x); break; }
+    mpc_input_success(i, x, NULL);
+    if (o && n + 1 >= slots) {
+      slots = slots * 2;
+      *o = mpc_realloc(i, *o, slots);
+    }
+    if (o) { (*o)[n] = x; }
+    n++;
+  }
+  
+  if (o) { (*o)[n] = '\0'; }
+  return n;
+}
+
+/*
+** Copies out everything read since `start`. Pipes
+** can only do this while a mark is held there.
+*/
+
+static char *mpc_input_slice(mpc_input_t *i, long start) {
+  
+  long n = i->pos - start;
+  char *o = mpc_calloc(i, 1, n + 1);
+  
+  if (n == 0) { return o; }
+  
+  switch (i->type) {
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP: memcpy(o, i->string + start, n); break;
+    case MPC_INPUT_PIPE: memcpy(o, i->buffer + (start - i->buffer_start), n); break;
+    case MPC_INPUT_FILE:
+      fseek(i->file, start, SEEK_SET);
+      n = (long)fread(o, 1, n, i->file);
+      fseek(i->file, i->pos, SEEK_SET);
+      break;
+  }
+  
+  o[n] = '\0';
+  return o;
 }
 
 static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
@@ -526,19 +1101,21 @@ static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   }
   mpc_input_unmark(i);
   
-  *o = mpc_malloc(i, strlen(c) + 1);
-  strcpy(*o, c);
+  if (o) {
+    *o = mpc_malloc(i, strlen(c) + 1);
+    strcpy(*o, c);
+  }
   return 1;
 }
 
 static int mpc_input_anchor(mpc_input_t* i, int(*f)(char,char), char **o) {
-  *o = NULL;
+  if (o) { *o = NULL; }
   return f(i->last, mpc_input_peekc(i));
 }
 
 static mpc_state_t *mpc_input_state_copy(mpc_input_t *i) {
   mpc_state_t *r = mpc_malloc(i, sizeof(mpc_state_t));
-  memcpy(r, &i->state, sizeof(mpc_state_t));
+  *r = mpc_input_state_at(i, i->pos);
   return r;
 }
 
@@ -608,12 +1185,18 @@ char *mpc_err_string(mpc_err_t *x) {
   int max = 1023;
   char *buffer = calloc(1, 1024);
   
-  if (x->failure) {
+  if (x->failure && x->state.row < 0) {
     mpc_err_string_cat(buffer, &pos, &max,
     "%s: error: %s\n", x->filename, x->failure);
     return buffer;
   }
   
+  if (x->failure) {
+    mpc_err_string_cat(buffer, &pos, &max,
+    "%s:%i:%i: error: %s\n", x->filename, x->state.row+1, x->state.col+1, x->failure);
+    return buffer;
+  }
+  
   mpc_err_string_cat(buffer, &pos, &max, 
     "%s:%i:%i: error: expected ", x->filename, x->state.row+1, x->state.col+1);
   
@@ -637,17 +1220,73 @@ char *mpc_err_string(mpc_err_t *x) {
   return realloc(buffer, strlen(buffer) + 1);
 }
 
+/*
+** Inside a parse an error's expected strings are
+** labels interned in the input, so they are found
+** in a set and copied by pointer, and its filename
+** is the input's own. `mpc_err_finish` gives it
+** copies of its own as it leaves the parse.
+*/
+
+static size_t mpc_input_label_hash(const char *s) {
+  size_t h = 5381;
+  while (*s) { h = h * 33 + (unsigned char)*s++; }
+  return h;
+}
+
+static void mpc_input_labels_grow(mpc_input_t *i) {
+  
+  char **labels = i->labels;
+  int j, slots = i->labels_slots;
+  size_t h;
+  
+  i->labels_slots = slots ? slots * 2 : 64;
+  i->labels = calloc(i->labels_slots, sizeof(char*));
+  
+  for (j = 0; j < slots; j++) {
+    if (labels[j] == NULL) { continue; }
+    h = mpc_input_label_hash(labels[j]);
+    while (i->labels[h % i->labels_slots]) { h++; }
+    i->labels[h % i->labels_slots] = labels[j];
+  }
+  
+  free(labels);
+}
+
+static void mpc_input_labels_delete(mpc_input_t *i) {
+  int j;
+  for (j = 0; j < i->labels_slots; j++) { free(i->labels[j]); }
+  free(i->labels);
+}
+
+static char *mpc_input_label(mpc_input_t *i, const char *s) {
+  
+  size_t h = mpc_input_label_hash(s);
+  char **l;
+  
+  if ((i->labels_num + 1) * 2 > i->labels_slots) { mpc_input_labels_grow(i); }
+  
+  for (;; h++) {
+    l = &i->labels[h % i->labels_slots];
+    if (*l == NULL) { break; }
+    if (strcmp(*l, s) == 0) { return *l; }
+  }
+  
+  *l = malloc(strlen(s) + 1);
+  strcpy(*l, s);
+  i->labels_num++;
+  return *l;
+}
+
 static mpc_err_t *mpc_err_new(mpc_input_t *i, const char *expected) {
   mpc_err_t *x;
   if (i->suppress) { return NULL; }
   x = mpc_malloc(i, sizeof(mpc_err_t));
-  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
-  strcpy(x->filename, i->filename);
-  x->state = i->state;
+  x->filename = i->filename;
+  x->state = mpc_state_pos(i->pos);
   x->expected_num = 1;
   x->expected = mpc_malloc(i, sizeof(char*));
-  x->expected[0] = mpc_malloc(i, strlen(expected) + 1);
-  strcpy(x->expected[0], expected);
+  x->expected[0] = mpc_input_label(i, expected);
   x->failure = NULL;
   x->recieved = mpc_input_peekc(i);
   return x;
@@ -657,9 +1296,8 @@ static mpc_err_t *mpc_err_fail(mpc_input_t *i, const char *failure) {
   mpc_err_t *x;
   if (i->suppress) { return NULL; }
   x = mpc_malloc(i, sizeof(mpc_err_t));
-  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
-  strcpy(x->filename, i->filename);
-  x->state = i->state;
+  x->filename = i->filename;
+  x->state = mpc_state_pos(i->pos);
   x->expected_num = 0;
   x->expected = NULL;
   x->failure = mpc_malloc(i, strlen(failure) + 1);
@@ -673,7 +1311,7 @@ static mpc_err_t *mpc_err_file(const char *filename, const char *failure) {
   x = malloc(sizeof(mpc_err_t));
   x->filename = malloc(strlen(filename) + 1);
   strcpy(x->filename, filename);
-  x->state = mpc_state_new();
+  x->state = mpc_state_invalid();
   x->expected_num = 0;
   x->expected = NULL;
   x->failure = malloc(strlen(failure) + 1);
@@ -683,46 +1321,83 @@ static mpc_err_t *mpc_err_file(const char *filename, const char *failure) {
 }
 
 static void mpc_err_delete_internal(mpc_input_t *i, mpc_err_t *x) {
-  int j;
   if (x == NULL) { return; }
-  for (j = 0; j < x->expected_num; j++) { mpc_free(i, x->expected[j]); }
   mpc_free(i, x->expected);
-  mpc_free(i, x->filename);
   mpc_free(i, x->failure);
   mpc_free(i, x);
 }
 
+/* Kept errors still share the input's labels */
 static mpc_err_t *mpc_err_export(mpc_input_t *i, mpc_err_t *x) {
-  int j;
-  for (j = 0; j < x->expected_num; j++) {
-    x->expected[j] = mpc_export(i, x->expected[j]);
-  }
   x->expected = mpc_export(i, x->expected);
-  x->filename = mpc_export(i, x->filename);
   x->failure = mpc_export(i, x->failure);
   return mpc_export(i, x);
 }
 
-static int mpc_err_contains_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
+/* The characters in a label like 'c' or "one of 'abc'", NULL for other labels */
+static const char *mpc_err_expected_chars(const char *e, size_t *n) {
+  size_t l;
+  if (e[0] == '\'') {
+    *n = 1;
+    return e[1] != '\0' && e[2] == '\'' && e[3] == '\0' ? e + 1 : NULL;
+  }
+  if (e[0] != 'o' || strncmp(e, "one of '", 8) != 0) { return NULL; }
+  l = strlen(e);
+  *n = l - 9;
+  return l > 9 && e[l-1] == '\'' ? e + 8 : NULL;
+}
+
+/*
+** Leaves out characters already in a class that's
+** expected, such as "one of '-0123456789'" from a
+** regex, so they aren't listed twice.
+*/
+static void mpc_err_tidy(mpc_err_t *x) {
+  
+  int j, k, n = 0;
+  size_t c, xn, yn;
+  const char *xs, *ys;
+  
+  for (j = 0; j < x->expected_num; j++) {
+    ys = mpc_err_expected_chars(x->expected[j], &yn);
+    for (k = 0; ys && k < x->expected_num; k++) {
+      xs = mpc_err_expected_chars(x->expected[k], &xn);
+      if (xs == NULL || xn <= yn) { continue; }
+      for (c = 0; c < yn && memchr(xs, ys[c], xn); c++);
+      if (c == yn) { break; }
+    }
+    if (ys == NULL || k == x->expected_num) { x->expected[n++] = x->expected[j]; }
+  }
+  x->expected_num = n;
+}
+
+static mpc_err_t *mpc_err_finish(mpc_input_t *i, mpc_err_t *x) {
   int j;
-  (void)i;
+  char *s;
+  mpc_err_tidy(x);
   for (j = 0; j < x->expected_num; j++) {
-    if (strcmp(x->expected[j], expected) == 0) { return 1; }
+    s = malloc(strlen(x->expected[j]) + 1);
+    strcpy(s, x->expected[j]);
+    x->expected[j] = s;
   }
-  return 0;
+  s = malloc(strlen(x->filename) + 1);
+  strcpy(s, x->filename);
+  x->filename = s;
+  x->state = mpc_input_state_at(i, x->state.pos);
+  return mpc_err_export(i, x);
 }
 
-static void mpc_err_add_expected(mpc_input_t *i, mpc_err_t *x, char *expected) {
-  (void)i;
-  x->expected_num++;
-  x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-  x->expected[x->expected_num-1] = mpc_malloc(i, strlen(expected) + 1);
-  strcpy(x->expected[x->expected_num-1], expected);
+static int mpc_err_contains_expected(mpc_err_t *x, char *expected) {
+  int j;
+  for (j = 0; j < x->expected_num; j++) {
+    if (x->expected[j] == expected) { return 1; }
+  }
+  return 0;
 }
 
 static mpc_err_t *mpc_err_or(mpc_input_t *i, mpc_err_t** x, int n) {
   
-  int j, k, fst;
+  int j, k, fst, num;
   mpc_err_t *e;
   
   fst = -1;
@@ -737,14 +1412,19 @@ static mpc_err_t *mpc_err_or(mpc_input_t *i, mpc_err_t** x, int n) {
   e->expected_num = 0;
   e->expected = NULL;
   e->failure = NULL;
-  e->filename = mpc_malloc(i, strlen(x[fst]->filename)+1);
-  strcpy(e->filename, x[fst]->filename);
+  e->filename = x[fst]->filename;
   
   for (j = 0; j < n; j++) {
     if (x[j] == NULL) { continue; }
     if (x[j]->state.pos > e->state.pos) { e->state = x[j]->state; }
   }
   
+  num = 0;
+  for (j = 0; j < n; j++) {
+    if (x[j] && x[j]->state.pos >= e->state.pos) { num += x[j]->expected_num; }
+  }
+  if (num) { e->expected = mpc_malloc(i, sizeof(char*) * num); }
+  
   for (j = 0; j < n; j++) {
     if (x[j] == NULL) { continue; }
     if (x[j]->state.pos < e->state.pos) { continue; }
@@ -758,8 +1438,8 @@ static mpc_err_t *mpc_err_or(mpc_input_t *i, mpc_err_t** x, int n) {
     e->recieved = x[j]->recieved;
     
     for (k = 0; k < x[j]->expected_num; k++) {
-      if (!mpc_err_contains_expected(i, e, x[j]->expected[k])) {
-        mpc_err_add_expected(i, e, x[j]->expected[k]);
+      if (!mpc_err_contains_expected(e, x[j]->expected[k])) {
+        e->expected[e->expected_num++] = x[j]->expected[k];
       }
     }
   }
@@ -781,10 +1461,9 @@ static mpc_err_t *mpc_err_repeat(mpc_input_t *i, mpc_err_t *x, const char *prefi
   if (x == NULL) { return NULL; }
   
   if (x->expected_num == 0) {
-    expect = mpc_calloc(i, 1, 1);
     x->expected_num = 1;
     x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-    x->expected[0] = expect;
+    x->expected[0] = mpc_input_label(i, "");
     return x;
   }
   
@@ -792,8 +1471,8 @@ static mpc_err_t *mpc_err_repeat(mpc_input_t *i, mpc_err_t *x, const char *prefi
     expect = mpc_malloc(i, strlen(prefix) + strlen(x->expected[0]) + 1);
     strcpy(expect, prefix);
     strcat(expect, x->expected[0]);
-    mpc_free(i, x->expected[0]);
-    x->expected[0] = expect;
+    x->expected[0] = mpc_input_label(i, expect);
+    mpc_free(i, expect);
     return x;
   }
   
@@ -816,12 +1495,10 @@ static mpc_err_t *mpc_err_repeat(mpc_input_t *i, mpc_err_t *x, const char *prefi
     strcat(expect, x->expected[x->expected_num-2]);
     strcat(expect, " or ");
     strcat(expect, x->expected[x->expected_num-1]);
-
-    for (j = 0; j < x->expected_num; j++) { mpc_free(i, x->expected[j]); }
     
     x->expected_num = 1;
-    x->expected = mpc_realloc(i, x->expected, sizeof(char*) * x->expected_num);
-    x->expected[0] = expect;
+    x->expected[0] = mpc_input_label(i, expect);
+    mpc_free(i, expect);
     return x;
   }
   
@@ -850,6 +1527,24 @@ static mpc_err_t *mpc_err_merge(mpc_input_t *i, mpc_err_t *x, mpc_err_t *y) {
   return mpc_err_or(i, errs, 2);
 }
 
+/* Expects the first `n` of `ms`, as merging them in one at a time would */
+static mpc_err_t *mpc_err_labels(mpc_input_t *i, char **ms, int n) {
+  
+  int j;
+  char *l;
+  mpc_err_t *x;
+  
+  if (n == 0 || i->suppress) { return NULL; }
+  
+  x = mpc_err_new(i, ms[0]);
+  x->expected = mpc_realloc(i, x->expected, sizeof(char*) * n);
+  for (j = 1; j < n; j++) {
+    l = mpc_input_label(i, ms[j]);
+    if (!mpc_err_contains_expected(x, l)) { x->expected[x->expected_num++] = l; }
+  }
+  return x;
+}
+
 /*
 ** Parser Type
 */
@@ -885,7 +1580,15 @@ enum {
   MPC_TYPE_AND        = 24,
 
   MPC_TYPE_CHECK      = 25,
-  MPC_TYPE_CHECK_WITH = 26
+  MPC_TYPE_CHECK_WITH = 26,
+  
+  MPC_TYPE_DFA        = 27,
+  MPC_TYPE_SPAN       = 28,
+  MPC_TYPE_SKIP       = 29,
+  MPC_TYPE_TRIE       = 30,
+  
+  /* How many types there are, keep last */
+  MPC_TYPE_NUM
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -896,15 +1599,19 @@ typedef struct { char x; } mpc_pdata_single_t;
 typedef struct { char x; char y; } mpc_pdata_range_t;
 typedef struct { int(*f)(char); } mpc_pdata_satisfy_t;
 typedef struct { char *x; } mpc_pdata_string_t;
+typedef struct { char *x; unsigned char set[32]; } mpc_pdata_oneof_t;
 typedef struct { mpc_parser_t *x; mpc_apply_t f; } mpc_pdata_apply_t;
 typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_to_t;
 typedef struct { mpc_parser_t *x; mpc_check_t f; char *e; } mpc_pdata_check_t;
 typedef struct { mpc_parser_t *x; mpc_check_with_t f; void *d; char *e; } mpc_pdata_check_with_t;
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
+typedef struct { mpc_parser_t *x; } mpc_pdata_span_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct { int n; mpc_parser_t **xs; unsigned char *dispatch; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { int n; int classes; unsigned char *map; int *next; char *accept; char **expected; } mpc_pdata_dfa_t;
+typedef struct { int n; int classes; char **xs; char **ms; unsigned char *map; int *next; } mpc_pdata_trie_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -915,15 +1622,19 @@ typedef union {
   mpc_pdata_range_t range;
   mpc_pdata_satisfy_t satisfy;
   mpc_pdata_string_t string;
+  mpc_pdata_oneof_t oneof;
   mpc_pdata_apply_t apply;
   mpc_pdata_apply_to_t apply_to;
   mpc_pdata_check_t check;
   mpc_pdata_check_with_t check_with;
   mpc_pdata_predict_t predict;
+  mpc_pdata_span_t span;
   mpc_pdata_not_t not;
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
+  mpc_pdata_trie_t trie;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -931,6 +1642,14 @@ struct mpc_parser_t {
   mpc_pdata_t data;
   char type;
   char retained;
+  int id;
+  mpca_action_t action;
+  mpc_dtor_t dtor;
+  char memo;
+  mpc_copy_t memo_copy;
+  mpc_dtor_t memo_dtor;
+  int depth_max;
+  char two_pass;
 };
 
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
@@ -962,8 +1681,14 @@ static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
   return a;
 }
 
+/*
+** Inside a span no values are made at all, all
+** of them are NULL and nothing is called on them.
+*/
+
 static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t **xs) {
   int j;
+  if (i->spanning)         { return NULL; }
   if (f == mpcf_null)      { return mpcf_null(n, xs); }
   if (f == mpcf_fst)       { return mpcf_fst(n, xs); }
   if (f == mpcf_snd)       { return mpcf_snd(n, xs); }
@@ -983,294 +1708,1143 @@ static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
 }
 
 static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
+  mpc_ast_t *a;
+  if (i->arena == NULL) { i->arena = mpc_ast_arena_new(); }
+  a = mpc_ast_new_in(i->arena, "", c);
   mpc_free(i, c);
   return a;
 }
 
 static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
+  if (i->spanning)        { return NULL; }
   if (f == mpcf_free)     { return mpcf_input_free(i, x); }
   if (f == mpcf_str_ast)  { return mpcf_input_str_ast(i, x); }
   return f(mpc_export(i, x));
 }
 
 static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d) {
+  if (i->spanning) { return NULL; }
   return f(mpc_export(i, x), d);
 }
 
+static mpc_val_t *mpc_parse_lift(mpc_input_t *i, mpc_ctor_t f) {
+  return i->spanning ? NULL : f();
+}
+
 static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
+  if (i->spanning) { return; }
   if (d == free) { mpc_free(i, x); return; }
   d(mpc_export(i, x));
 }
 
+/*
+** Memo Table
+**
+** One slot per (parser, position) hash, a new
+** entry throws out whatever was in its slot.
+** Everything kept is exported so it doesn't
+** tie up the input's memory pool.
+**
+** What the entries hold is counted in bytes and
+** nothing more is kept past MPC_INPUT_MEMO_BYTES
+** until entries are thrown out. A success is taken
+** to be as big as the input it matched, apart from
+** trees shared by 'mpc_ast_share', which are a node.
+**
+** Next to it is the set of parsers whose successes
+** have been asked for again, hashed the same way.
+*/
+
+static void mpc_input_memo_clear(mpc_input_t *i, mpc_memo_t *m) {
+  if (m->p && m->output) { m->p->memo_dtor(m->output); }
+  mpc_err_delete_internal(i, m->error);
+  mpc_err_delete_internal(i, m->merged);
+  i->memo_bytes -= m->bytes;
+  memset(m, 0, sizeof(mpc_memo_t));
+}
+
+static void mpc_input_memo_delete(mpc_input_t *i) {
+  int j;
+  for (j = 0; j < MPC_INPUT_MEMO_NUM; j++) { mpc_input_memo_clear(i, &i->memo[j]); }
+  free(i->memo);
+  free(i->reasked);
+  i->memo = NULL;
+  i->reasked = NULL;
+}
+
+static mpc_memo_t *mpc_input_memo_slot(mpc_input_t *i, mpc_parser_t *p, long pos) {
+  size_t h = ((size_t)p >> 4) ^ ((size_t)pos * 2654435761u);
+  if (i->memo == NULL) {
+    i->memo = calloc(MPC_INPUT_MEMO_NUM, sizeof(mpc_memo_t));
+    i->reasked = calloc(MPC_INPUT_REASKED_NUM, sizeof(mpc_parser_t*));
+    i->memo_bytes = 0;
+  }
+  return &i->memo[h % MPC_INPUT_MEMO_NUM];
+}
+
+static size_t mpc_input_memo_err_bytes(mpc_err_t *e) {
+  if (e == NULL) { return 0; }
+  return sizeof(mpc_err_t) + sizeof(char*) * e->expected_num + (e->failure ? strlen(e->failure) + 1 : 0);
+}
+
+/* Takes `bytes` more for entry `m` if they fit under the cap */
+static int mpc_input_memo_fits(mpc_input_t *i, mpc_memo_t *m, size_t bytes) {
+  if (i->memo_bytes + bytes > MPC_INPUT_MEMO_BYTES) { return 0; }
+  i->memo_bytes += bytes;
+  m->bytes += bytes;
+  return 1;
+}
+
+/* Keeps a copy of success `x`, matched from `start`, unless it doesn't fit */
+static void mpc_input_memo_keep(mpc_input_t *i, mpc_memo_t *m, mpc_parser_t *p, mpc_val_t *x, long start) {
+  size_t bytes = p->memo_copy == (mpc_copy_t)mpc_ast_share ? sizeof(mpc_ast_t) : (size_t)(i->pos - start);
+  if (!mpc_input_memo_fits(i, m, bytes)) { return; }
+  m->output = x ? p->memo_copy(x) : NULL;
+  m->kept = 1;
+}
+
+static mpc_parser_t **mpc_input_reasked_slot(mpc_input_t *i, mpc_parser_t *p) {
+  return &i->reasked[((size_t)p >> 4) % MPC_INPUT_REASKED_NUM];
+}
+
+/*
+** Skip Table
+**
+** What each skipped `or` alternative expects, kept
+** by the input in the same way as the memo table.
+** An entry with no error means it expects nothing.
+*/
+
+static void mpc_input_skips_delete(mpc_input_t *i) {
+  int j;
+  for (j = 0; j < MPC_INPUT_SKIP_NUM; j++) { mpc_err_delete_internal(i, i->skips[j].error); }
+  free(i->skips);
+}
+
+static mpc_skip_t *mpc_input_skip_slot(mpc_input_t *i, mpc_parser_t *p, int j) {
+  size_t h = ((size_t)p >> 4) ^ ((size_t)j * 2654435761u);
+  if (i->skips == NULL) { i->skips = calloc(MPC_INPUT_SKIP_NUM, sizeof(mpc_skip_t)); }
+  return &i->skips[h % MPC_INPUT_SKIP_NUM];
+}
+
+static mpc_err_t *mpc_err_copy(mpc_input_t *i, mpc_err_t *x) {
+  
+  int j;
+  mpc_err_t *y;
+  
+  if (x == NULL) { return NULL; }
+  
+  y = mpc_malloc(i, sizeof(mpc_err_t));
+  y->state = x->state;
+  y->filename = x->filename;
+  y->expected_num = x->expected_num;
+  y->expected = x->expected_num ? mpc_malloc(i, sizeof(char*) * x->expected_num) : NULL;
+  for (j = 0; j < x->expected_num; j++) { y->expected[j] = x->expected[j]; }
+  y->failure = NULL;
+  if (x->failure) {
+    y->failure = mpc_malloc(i, strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+  y->recieved = x->recieved;
+  return y;
+}
+
+/*
+** Runs a regex compiled by `mpc_re_dfa` for the
+** longest match. On string input this is a loop
+** straight over the characters, otherwise they are
+** read one at a time with a mark left at the last
+** accepting point so anything read past the end of
+** the match can be given back. Like the parsers it
+** stands in for, it leaves an error at the point
+** where it got stuck even when it succeeds.
+*/
+
+static int mpc_parse_dfa(mpc_input_t *i, mpc_pdata_dfa_t *d, mpc_result_t *r, mpc_err_t **e) {
+  
+  int s = 0, t, backtrack;
+  long j, end, len = 0, slots = 0;
+  char c, last;
+  char *out = NULL;
+  long start;
+  mpc_err_t *err = NULL;
+  
+  if (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP) {
+    
+    end = d->accept[0] ? i->pos : -1;
+    for (j = i->pos; j < i->length; j++) {
+      t = d->next[s * d->classes + d->map[(unsigned char)i->string[j]]];
+      if (t < 0) { break; }
+      s = t;
+      if (d->accept[s]) { end = j + 1; }
+    }
+    
+    if (d->expected[s] && !i->suppress) {
+      start = i->pos;
+      last = i->last;
+      mpc_input_advance(i, j);
+      err = mpc_err_new(i, d->expected[s]);
+      i->pos = start;
+      i->last = last;
+    }
+    
+    if (end < 0) {
+      r->error = err;
+      return 0;
+    }
+    
+    if (err) { *e = mpc_err_merge(i, *e, err); }
+    
+    if (!i->spanning) {
+      out = mpc_malloc(i, end - i->pos + 1);
+      memcpy(out, i->string + i->pos, end - i->pos);
+      out[end - i->pos] = '\0';
+    }
+    mpc_input_advance(i, end);
+    r->output = out;
+    return 1;
+  }
+  
+  /* The marks are needed to give back characters even when predictive */
+  backtrack = i->backtrack;
+  i->backtrack = 1;
+  
+  mpc_input_mark(i);
+  end = -1;
+  if (d->accept[0]) { mpc_input_mark(i); end = 0; }
+  
+  while (1) {
+    
+    c = mpc_input_getc(i);
+    if (mpc_input_terminated(i)) { break; }
+    
+    t = d->next[s * d->classes + d->map[(unsigned char)c]];
+    if (t < 0) { mpc_input_failure(i, c); break; }
+    
+    mpc_input_success(i, c, NULL);
+    s = t;
+    
+    if (len + 1 >= slots) {
+      slots = slots ? slots * 2 : 16;
+      out = out ? mpc_realloc(i, out, slots) : mpc_malloc(i, slots);
+    }
+    out[len++] = c;
+    
+    if (d->accept[s]) {
+      if (end >= 0) { mpc_input_unmark(i); }
+      mpc_input_mark(i);
+      end = len;
+    }
+  }
+  
+  if (d->expected[s]) { err = mpc_err_new(i, d->expected[s]); }
+  
+  if (end < 0) {
+    mpc_input_rewind(i);
+    i->backtrack = backtrack;
+    if (out) { mpc_free(i, out); }
+    r->error = err;
+    return 0;
+  }
+  
+  if (len > end) { mpc_input_rewind(i); } else { mpc_input_unmark(i); }
+  mpc_input_unmark(i);
+  i->backtrack = backtrack;
+  
+  if (err) { *e = mpc_err_merge(i, *e, err); }
+  
+  if (!out) { out = mpc_malloc(i, 1); }
+  out[end] = '\0';
+  if (i->spanning) { mpc_free(i, out); out = NULL; }
+  r->output = out;
+  return 1;
+}
+
+/*
+** Builds the trie over the literals `xs` that an
+** `or` of them is merged into by `mpc_optimise`.
+** Characters are numbered into classes as the DFAs
+** do, with class 0 for those in no literal. As that
+** never leads anywhere, the first entry of each
+** node is used for which literal ends there instead,
+** the first given if more than one does, or -1.
+*/
+
+static void mpc_trie_build(mpc_pdata_trie_t *d) {
+  
+  int j, s, t, k, n = 1, slots = 1;
+  const char *c;
+  
+  d->map = calloc(256, 1);
+  d->classes = 1;
+  for (j = 0; j < d->n; j++) {
+    for (c = d->xs[j]; *c; c++) {
+      if (d->map[(unsigned char)*c] == 0) { d->map[(unsigned char)*c] = d->classes++; }
+      slots++;
+    }
+  }
+  
+  d->next = malloc(sizeof(int) * slots * d->classes);
+  for (j = 0; j < slots * d->classes; j++) { d->next[j] = -1; }
+  
+  for (j = 0; j < d->n; j++) {
+    s = 0;
+    for (c = d->xs[j]; *c; c++) {
+      k = s * d->classes + d->map[(unsigned char)*c];
+      t = d->next[k];
+      if (t < 0) { t = n++; d->next[k] = t; }
+      s = t;
+    }
+    if (d->next[s * d->classes] < 0) { d->next[s * d->classes] = j; }
+  }
+  
+  d->next = realloc(d->next, sizeof(int) * n * d->classes);
+}
+
+/*
+** Stands in for the `or` of literals it was made
+** from, so it takes the first of them that matches,
+** which is the longest if longer ones are given
+** first. On strings and mmaps the trie is followed
+** for as long as something could still match, and
+** the ones before the match are added as errors as
+** the `or` would have added them. Other inputs, and
+** any that can't backtrack, try each literal in turn.
+*/
+
+static int mpc_parse_trie(mpc_input_t *i, mpc_pdata_trie_t *d, mpc_result_t *r, mpc_err_t **e) {
+  
+  int s = 0, k, m = -1;
+  long j;
+  mpc_err_t *err = NULL;
+  
+  if ((i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP) && i->backtrack > 0) {
+    
+    for (j = i->pos; j < i->length; j++) {
+      k = d->map[(unsigned char)i->string[j]];
+      if (k == 0) { break; }
+      s = d->next[s * d->classes + k];
+      if (s < 0) { break; }
+      k = d->next[s * d->classes];
+      if (k >= 0 && (m < 0 || k < m)) { m = k; }
+    }
+    
+    if (m < 0) {
+      r->error = mpc_err_labels(i, d->ms, d->n);
+      return 0;
+    }
+    
+    err = mpc_err_labels(i, d->ms, m);
+    if (err) { *e = mpc_err_merge(i, *e, err); }
+    
+    j = strlen(d->xs[m]);
+    if (!i->spanning) {
+      r->output = mpc_malloc(i, j + 1);
+      memcpy(r->output, d->xs[m], j + 1);
+    }
+    mpc_input_advance(i, i->pos + j);
+    return 1;
+  }
+  
+  for (k = 0; k < d->n; k++) {
+    if (mpc_input_string(i, d->xs[k], i->spanning ? NULL : (char**)&r->output)) {
+      if (err) { *e = mpc_err_merge(i, *e, err); }
+      return 1;
+    }
+    err = err ? mpc_err_merge(i, err, mpc_err_new(i, d->ms[k])) : mpc_err_new(i, d->ms[k]);
+  }
+  
+  r->error = err;
+  return 0;
+}
+
+enum {
+  MPC_PARSE_FRAMES_MIN = 64,
+  MPC_PARSE_VALUES_MIN = 64,
+  MPC_PARSE_DEPTH_MAX = 100000
+};
+
+/*
+** `mpc_optimise` gives each `or` a table saying which
+** alternatives could get anywhere from each next 
+** character, with one more entry for the end of input.
+** The rest are certain to fail without reading
+** anything, so they are skipped. An alternative that
+** fails after reading some input moves the next
+** character, so the table is looked up again. Unless
+** errors are suppressed skipped ones still have to add
+** what they expected, which only depends on the
+** alternative, so the first time in a parse one is
+** skipped it is run anyway and its errors are kept
+** in the input's skip table to hand out after that.
+*/
+
+static int mpc_or_dispatch_char(mpc_input_t *i, mpc_parser_t *p) {
+  if (p->data.or.dispatch == NULL) { return -1; }
+  if (i->type != MPC_INPUT_STRING && i->type != MPC_INPUT_MMAP) { return -1; }
+  return i->pos < i->length ? (unsigned char)i->string[i->pos] : 256;
+}
+
+static int mpc_or_viable(mpc_parser_t *p, int k, int j) {
+  return p->data.or.dispatch[k * ((p->data.or.n + 7) / 8) + j / 8] & (1 << (j % 8));
+}
+
+static mpc_err_t *mpc_or_template(mpc_input_t *i, mpc_err_t *t) {
+  t = mpc_err_copy(i, t);
+  t->state = mpc_state_pos(i->pos);
+  t->recieved = mpc_input_peekc(i);
+  return t;
+}
+
+/*
+** Parse Frames
+**
+** Rather than recursing once per parser the engine 
+** keeps its own stack of frames, so how deep a 
+** grammar can go is not limited by the C stack. 
+** A frame pushes its child and gives up its turn;
+** when the child is popped its result is left in
+** `x` and `res` and the parent carries on from
+** `stage`. Outputs waiting to be folded go on a
+** second stack, which a child always leaves as it
+** found it, so a frame's outputs are the ones from
+** `base` up. Both arrays move when they grow, so
+** everything is always found again by index.
+**
+** Memo frames sit around a memoized parser and 
+** skip frames around an `or` alternative that is 
+** run for its errors, each collecting the errors 
+** of what is under it in `local`. Every frame 
+** merges errors into the accumulator of the 
+** nearest one of these below it, given by `e`,
+** or into the caller's when that is -1.
+*/
+
 enum {
-  MPC_PARSE_STACK_MIN = 4
+  MPC_FRAME_MEMO = 64,
+  MPC_FRAME_SKIP = 65
 };
 
+typedef struct {
+  mpc_parser_t *p;
+  char type;
+  char start_last;
+  int stage;
+  int j;
+  int k;
+  int e;
+  int base;
+  mpc_err_t *local;
+  long start;
+} mpc_frame_t;
+
+typedef struct {
+  int num;
+  int slots;
+  int max;
+  int overflow;
+  long abort;
+  mpc_frame_t *frames;
+  int vals_num;
+  int vals_slots;
+  mpc_result_t *vals;
+} mpc_stack_t;
+
+static int mpc_stack_push(mpc_stack_t *s, mpc_parser_t *p, int type, int e) {
+  
+  mpc_frame_t *f;
+  
+  if (s->num >= s->max) { s->overflow = 1; return 0; }
+  
+  if (s->num == s->slots) {
+    s->slots = s->slots * 2;
+    s->frames = realloc(s->frames, sizeof(mpc_frame_t) * s->slots);
+  }
+  
+  f = &s->frames[s->num++];
+  f->p = p;
+  f->type = type;
+  f->stage = 0;
+  f->e = e;
+  return 1;
+}
+
+static int mpc_frame_type(mpc_input_t *i, mpc_parser_t *p) {
+  return p->memo && !i->spanning && (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP)
+    ? MPC_FRAME_MEMO : p->type;
+}
+
+static void mpc_stack_value(mpc_stack_t *s, mpc_result_t x) {
+  if (s->vals_num == s->vals_slots) {
+    s->vals_slots = s->vals_slots * 2;
+    s->vals = realloc(s->vals, sizeof(mpc_result_t) * s->vals_slots);
+  }
+  s->vals[s->vals_num++] = x;
+}
+
+static mpc_val_t *mpc_stack_fold(mpc_input_t *i, mpc_stack_t *s, int base, mpc_fold_t f) {
+  mpc_val_t *x = mpc_parse_fold(i, f, s->vals_num - base, (mpc_val_t**)(s->vals + base));
+  s->vals_num = base;
+  return x;
+}
+
 #define MPC_SUCCESS(x) r->output = x; return 1
 #define MPC_FAILURE(x) r->error = x; return 0
 #define MPC_PRIMITIVE(x) \
   if (x) { MPC_SUCCESS(r->output); } \
   else { MPC_FAILURE(NULL); }
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+/*
+** A `many` or `many1` string fold over a `oneof` 
+** or `noneof` (through any expects) is a span. It
+** reads the whole run in one go from the class
+** bitmap. `m` is set to the outermost expect.
+*/
+
+static const unsigned char *mpc_span_class(mpc_parser_t *p, const char **m) {
+  
+  mpc_parser_t *x;
   
-  int j = 0, k = 0;
-  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
-  mpc_result_t *results;
-  int results_slots = MPC_PARSE_STACK_MIN;
+  if ((p->type != MPC_TYPE_MANY && p->type != MPC_TYPE_MANY1)
+  ||  p->data.repeat.f != mpcf_strfold) { return NULL; }
   
+  *m = NULL;
+  x = p->data.repeat.x;
+  while (x->type == MPC_TYPE_EXPECT && !x->memo) {
+    if (*m == NULL) { *m = x->data.expect.m; }
+    x = x->data.expect.x;
+  }
+  
+  if (x->memo || (x->type != MPC_TYPE_ONEOF && x->type != MPC_TYPE_NONEOF)) { return NULL; }
+  return x->data.oneof.set;
+}
+
+/*
+** Parsers that don't run anything else are done 
+** straight away instead of being given a frame,
+** as are spans and expects and applies of them.
+** Returns -1 if `p` isn't one of them.
+*/
+
+static int mpc_type_leaf(mpc_parser_t *p) {
+  const char *m;
+  if (p->memo) { return 0; }
+  if (p->type == MPC_TYPE_MANY || p->type == MPC_TYPE_MANY1) { return mpc_span_class(p, &m) != NULL; }
+  return (p->type < MPC_TYPE_APPLY && p->type != MPC_TYPE_EXPECT)
+    || p->type == MPC_TYPE_DFA || p->type == MPC_TYPE_SKIP || p->type == MPC_TYPE_TRIE;
+}
+
+static int mpc_parse_is_leaf(mpc_parser_t *p) {
+  if (p->memo) { return 0; }
   switch (p->type) {
-      
-    /* Basic Parsers */
+    case MPC_TYPE_EXPECT:   return mpc_type_leaf(p->data.expect.x);
+    case MPC_TYPE_APPLY:    return mpc_type_leaf(p->data.apply.x);
+    case MPC_TYPE_APPLY_TO: return mpc_type_leaf(p->data.apply_to.x);
+    default: return mpc_type_leaf(p);
+  }
+}
+
+static int mpc_parse_span(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  
+  const char *m;
+  const unsigned char *set = mpc_span_class(p, &m);
+  long n = mpc_input_span(i, set, i->spanning ? NULL : (char**)&r->output);
+  mpc_err_t *err = m ? mpc_err_new(i, m) : NULL;
+  
+  if (p->type == MPC_TYPE_MANY1 && n == 0) {
+    mpc_free(i, r->output);
+    r->error = mpc_err_many1(i, err);
+    return 0;
+  }
+  
+  if (err) { *e = mpc_err_merge(i, *e, err); }
+  return 1;
+}
 
-    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
-    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
-    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
-    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
-    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
+static int mpc_parse_leaf(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  
+  char **o = i->spanning ? NULL : (char**)&r->output;
+  r->output = NULL;
+  
+  switch (p->type) {
+    
+    /* Basic Parsers */
+    
+    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, o));
+    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, o));
+    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, o));
+    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_class(i, p->data.oneof.set, o));
+    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_class(i, p->data.oneof.set, o));
+    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, o));
+    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, o));
+    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, o));
+    
+    case MPC_TYPE_DFA:  return mpc_parse_dfa(i, &p->data.dfa, r, e);
+    case MPC_TYPE_TRIE: return mpc_parse_trie(i, &p->data.trie, r, e);
+    
+    case MPC_TYPE_SKIP:
+      mpc_input_span(i, p->data.oneof.set, NULL);
+      MPC_SUCCESS(NULL);
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1: return mpc_parse_span(i, p, r, e);
     
     /* Other parsers */
     
     case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
     case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
     case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
-    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
-    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
-    case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
+    case MPC_TYPE_LIFT:      MPC_SUCCESS(mpc_parse_lift(i, p->data.lift.lf));
+    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(i->spanning ? NULL : p->data.lift.x);
+    case MPC_TYPE_STATE:     MPC_SUCCESS(i->spanning ? NULL : mpc_input_state_copy(i));
+    
+    /* Wrappers */
     
-    /* Application Parsers */
+    case MPC_TYPE_EXPECT:
+      mpc_input_suppress_enable(i);
+      if (mpc_parse_leaf(i, p->data.expect.x, r, e)) {
+        mpc_input_suppress_disable(i);
+        MPC_SUCCESS(r->output);
+      } else {
+        mpc_input_suppress_disable(i);
+        MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
+      }
     
     case MPC_TYPE_APPLY:
-      if (mpc_parse_run(i, p->data.apply.x, r, e)) {
+      if (mpc_parse_leaf(i, p->data.apply.x, r, e)) {
         MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
       } else {
         MPC_FAILURE(r->output);
       }
     
     case MPC_TYPE_APPLY_TO:
-      if (mpc_parse_run(i, p->data.apply_to.x, r, e)) {
+      if (mpc_parse_leaf(i, p->data.apply_to.x, r, e)) {
         MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
       } else {
         MPC_FAILURE(r->error);
       }
+    
+    default: return -1;
+  }
+}
 
-    case MPC_TYPE_CHECK:
-      if (mpc_parse_run(i, p->data.check.x, r, e)) {
-        if (p->data.check.f(&r->output)) {
-          MPC_SUCCESS(r->output);
-        } else {
-          MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
-        }
-      } else {
-        MPC_FAILURE(r->error);
-      }
-
-    case MPC_TYPE_CHECK_WITH:
-      if (mpc_parse_run(i, p->data.check_with.x, r, e)) {
-        if (p->data.check_with.f(&r->output, p->data.check_with.d)) {
-          MPC_SUCCESS(r->output);
-        } else {
-          MPC_FAILURE(mpc_err_fail(i, p->data.check_with.e));
-        }
-      } else {
-        MPC_FAILURE(r->error);
-      }
+#undef MPC_SUCCESS
+#undef MPC_FAILURE
+#undef MPC_PRIMITIVE
 
-    case MPC_TYPE_EXPECT:
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.expect.x, r, e)) {
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_suppress_disable(i);
-        MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
-      }
-    
-    case MPC_TYPE_PREDICT:
-      mpc_input_backtrack_disable(i);
-      if (mpc_parse_run(i, p->data.predict.x, r, e)) {      
-        mpc_input_backtrack_enable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_backtrack_enable(i);
-        MPC_FAILURE(r->error);
-      }
-    
-    /* Optional Parsers */
-    
-    /* TODO: Update Not Error Message */
-    
-    case MPC_TYPE_NOT:
-      mpc_input_mark(i);
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.not.x, r, e)) {
-        mpc_input_rewind(i);
-        mpc_input_suppress_disable(i);
-        mpc_parse_dtor(i, p->data.not.dx, r->output);
-        MPC_FAILURE(mpc_err_new(i, "opposite"));
-      } else {
-        mpc_input_unmark(i);
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(p->data.not.lf());
-      }
-    
-    case MPC_TYPE_MAYBE:
-      if (mpc_parse_run(i, p->data.not.x, r, e)) {
-        MPC_SUCCESS(r->output);
-      } else {
-        *e = mpc_err_merge(i, *e, r->error);
-        MPC_SUCCESS(p->data.not.lf());
-      }
+#define MPC_SUCCESS(v) { res.output = (v); x = 1; s.num--; continue; }
+#define MPC_FAILURE(v) { res.error = (v); x = 0; s.num--; continue; }
+#define MPC_CALL(q, t, a) { \
+  mpc_parser_t *call_p = (q); \
+  int call_type = (t), call_e = (a); \
+  if (i->aborted) { \
+    x = 0; res.error = NULL; \
+  } else if (s.num < s.slots && s.num < s.max) { \
+    f = &s.frames[s.num++]; \
+    f->p = call_p; f->type = call_type; f->stage = 0; f->e = call_e; \
+  } else if (!mpc_stack_push(&s, call_p, call_type, call_e)) { \
+    x = 0; res.error = NULL; \
+    i->aborted = 1; s.abort = i->pos; \
+  } continue; }
+#define MPC_CHILD(q) { \
+  if (i->aborted) { x = 0; res.error = NULL; continue; } \
+  if (mpc_parse_is_leaf(q)) { x = mpc_parse_leaf(i, (q), &res, acc); continue; } \
+  MPC_CALL(q, mpc_frame_type(i, q), f->e); }
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *root, mpc_result_t *r, mpc_err_t **e) {
+  
+  int x = 0, k;
+  mpc_result_t res;
+  mpc_stack_t s;
+  mpc_frame_t *f;
+  mpc_parser_t *p;
+  mpc_err_t **acc;
+  mpc_memo_t *m;
+  mpc_skip_t *sk;
+  
+  s.num = 0;
+  s.slots = MPC_PARSE_FRAMES_MIN;
+  s.max = root->depth_max > 0 ? root->depth_max : MPC_PARSE_DEPTH_MAX;
+  s.frames = malloc(sizeof(mpc_frame_t) * s.slots);
+  s.vals_num = 0;
+  s.vals_slots = MPC_PARSE_VALUES_MIN;
+  s.vals = malloc(sizeof(mpc_result_t) * s.vals_slots);
+  res.output = NULL;
+  
+  s.overflow = 0;
+  i->aborted = 0;
+  if (!mpc_stack_push(&s, root, mpc_frame_type(i, root), -1)) {
+    x = 0; res.error = NULL;
+    i->aborted = 1; s.abort = i->pos;
+  }
+  
+  while (s.num > 0) {
     
-    /* Repeat Parsers */
+    f = &s.frames[s.num-1];
+    p = f->p;
+    acc = f->e < 0 ? e : &s.frames[f->e].local;
     
-    case MPC_TYPE_MANY:
+    switch (f->type) {
       
-      results = results_stk;
+      /* Application Parsers */
       
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
+      case MPC_TYPE_APPLY:
+        if (f->stage == 0) { f->stage = 1; MPC_CHILD(p->data.apply.x); }
+        if (x) {
+          MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, res.output));
+        } else {
+          MPC_FAILURE(res.output);
         }
-      }
       
-      *e = mpc_err_merge(i, *e, results[j].error);
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-    
-    case MPC_TYPE_MANY1:
+      case MPC_TYPE_APPLY_TO:
+        if (f->stage == 0) { f->stage = 1; MPC_CHILD(p->data.apply_to.x); }
+        if (x) {
+          MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, res.output, p->data.apply_to.d));
+        } else {
+          MPC_FAILURE(res.error);
+        }
       
-      results = results_stk;
+      case MPC_TYPE_CHECK:
+        if (f->stage == 0) { f->stage = 1; MPC_CHILD(p->data.check.x); }
+        if (x) {
+          if (p->data.check.f(&res.output)) {
+            MPC_SUCCESS(res.output);
+          } else {
+            MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
+          }
+        } else {
+          MPC_FAILURE(res.error);
+        }
       
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
+      case MPC_TYPE_CHECK_WITH:
+        if (f->stage == 0) { f->stage = 1; MPC_CHILD(p->data.check_with.x); }
+        if (x) {
+          if (p->data.check_with.f(&res.output, p->data.check_with.d)) {
+            MPC_SUCCESS(res.output);
+          } else {
+            MPC_FAILURE(mpc_err_fail(i, p->data.check_with.e));
+          }
+        } else {
+          MPC_FAILURE(res.error);
         }
-      }
       
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        *e = mpc_err_merge(i, *e, results[j].error);
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      }
-    
-    case MPC_TYPE_COUNT:
+      case MPC_TYPE_EXPECT:
+        if (f->stage == 0) {
+          f->stage = 1;
+          mpc_input_suppress_enable(i);
+          MPC_CHILD(p->data.expect.x);
+        }
+        mpc_input_suppress_disable(i);
+        if (x) {
+          MPC_SUCCESS(res.output);
+        } else {
+          MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
+        }
       
-      results = p->data.repeat.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
-        : results_stk;
+      case MPC_TYPE_PREDICT:
+        if (f->stage == 0) {
+          f->stage = 1;
+          mpc_input_backtrack_disable(i);
+          MPC_CHILD(p->data.predict.x);
+        }
+        mpc_input_backtrack_enable(i);
+        if (x) {
+          MPC_SUCCESS(res.output);
+        } else {
+          MPC_FAILURE(res.error);
+        }
       
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e)) {
-        j++;
-        if (j == p->data.repeat.n) { break; }
-      }
+      case MPC_TYPE_SPAN:
+        if (f->stage == 0) {
+          f->stage = 1;
+          f->start = i->pos;
+          /* Like the DFA, hold a mark even when predictive so pipes keep the text */
+          if (i->type == MPC_INPUT_PIPE) {
+            k = i->backtrack; i->backtrack = 1; mpc_input_mark(i); i->backtrack = k;
+          }
+          i->spanning++;
+          MPC_CHILD(p->data.span.x);
+        }
+        i->spanning--;
+        if (x) { res.output = mpc_input_slice(i, f->start); }
+        if (i->type == MPC_INPUT_PIPE) {
+          k = i->backtrack; i->backtrack = 1; mpc_input_unmark(i); i->backtrack = k;
+        }
+        if (x) {
+          MPC_SUCCESS(res.output);
+        } else {
+          MPC_FAILURE(res.error);
+        }
       
-      if (j == p->data.repeat.n) {
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        for (k = 0; k < j; k++) {
-          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
+      /* Optional Parsers */
+      
+      /* TODO: Update Not Error Message */
+      
+      case MPC_TYPE_NOT:
+        if (f->stage == 0) {
+          f->stage = 1;
+          mpc_input_mark(i);
+          mpc_input_suppress_enable(i);
+          MPC_CHILD(p->data.not.x);
+        }
+        if (x) {
+          mpc_input_rewind(i);
+          mpc_input_suppress_disable(i);
+          mpc_parse_dtor(i, p->data.not.dx, res.output);
+          MPC_FAILURE(mpc_err_new(i, "opposite"));
+        } else {
+          mpc_input_unmark(i);
+          mpc_input_suppress_disable(i);
+          MPC_SUCCESS(mpc_parse_lift(i, p->data.not.lf));
         }
-        MPC_FAILURE(
-          mpc_err_count(i, results[j].error, p->data.repeat.n);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });  
-      }
       
-    /* Combinatory Parsers */
-    
-    case MPC_TYPE_OR:
+      case MPC_TYPE_MAYBE:
+        if (f->stage == 0) { f->stage = 1; MPC_CHILD(p->data.not.x); }
+        if (x) {
+          MPC_SUCCESS(res.output);
+        } else {
+          *acc = mpc_err_merge(i, *acc, res.error);
+          MPC_SUCCESS(mpc_parse_lift(i, p->data.not.lf));
+        }
+      
+      /* Repeat Parsers */
       
-      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+      case MPC_TYPE_MANY:
+      case MPC_TYPE_MANY1:
+        
+        if (f->stage == 0) {
+          f->stage = 1;
+          f->j = 0;
+          f->base = s.vals_num;
+          MPC_CHILD(p->data.repeat.x);
+        }
+        
+        if (x) {
+          mpc_stack_value(&s, res);
+          f->j++;
+          MPC_CHILD(p->data.repeat.x);
+        }
+        
+        if (p->type == MPC_TYPE_MANY1 && f->j == 0) {
+          s.vals_num = f->base;
+          MPC_FAILURE(mpc_err_many1(i, res.error));
+        }
+        
+        *acc = mpc_err_merge(i, *acc, res.error);
+        MPC_SUCCESS(mpc_stack_fold(i, &s, f->base, p->data.repeat.f));
       
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+      case MPC_TYPE_COUNT:
+        
+        if (f->stage == 0) {
+          f->stage = 1;
+          f->j = 0;
+          f->base = s.vals_num;
+          MPC_CHILD(p->data.repeat.x);
+        }
+        
+        if (x) {
+          mpc_stack_value(&s, res);
+          f->j++;
+          if (f->j == p->data.repeat.n) {
+            MPC_SUCCESS(mpc_stack_fold(i, &s, f->base, p->data.repeat.f));
+          }
+          MPC_CHILD(p->data.repeat.x);
+        }
+        
+        for (k = 0; k < f->j; k++) {
+          mpc_parse_dtor(i, p->data.repeat.dx, s.vals[f->base + k].output);
+        }
+        s.vals_num = f->base;
+        MPC_FAILURE(mpc_err_count(i, res.error, p->data.repeat.n));
       
-      for (j = 0; j < p->data.or.n; j++) {
-        if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e)) {
-          MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      /* Combinatory Parsers */
+      
+      case MPC_TYPE_OR:
+        
+        if (f->stage == 0) {
+          if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+          f->k = mpc_or_dispatch_char(i, p);
+          f->start = i->pos;
+          f->j = 0;
+          i->or_stats.ors++;
+        } else if (x) {
+          MPC_SUCCESS(res.output);
         } else {
-          *e = mpc_err_merge(i, *e, results[j].error);
-        } 
-      }
+          if (f->stage == 1) { *acc = mpc_err_merge(i, *acc, res.error); }
+          if (i->pos != f->start) {
+            f->k = mpc_or_dispatch_char(i, p);
+            f->start = i->pos;
+          }
+          f->j++;
+        }
+        
+        /* Skipped alternatives with errors already known don't need a frame */
+        for (; f->j < p->data.or.n; f->j++) {
+          if (f->k < 0 || mpc_or_viable(p, f->k, f->j)) { break; }
+          if (!i->suppress) {
+            sk = mpc_input_skip_slot(i, p, f->j);
+            if (sk->p != p || sk->j != f->j) { break; }
+            if (sk->error) { *acc = mpc_err_merge(i, *acc, mpc_or_template(i, sk->error)); }
+          }
+          i->or_stats.skipped++;
+        }
+        
+        if (f->j == p->data.or.n) { MPC_FAILURE(NULL); }
+        
+        i->or_stats.tried++;
+        
+        if (f->k < 0 || mpc_or_viable(p, f->k, f->j)) {
+          f->stage = 1;
+          MPC_CHILD(p->data.or.xs[f->j]);
+        } else {
+          f->stage = 2;
+          MPC_CALL(p, MPC_FRAME_SKIP, f->e);
+        }
       
-      MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-    
-    case MPC_TYPE_AND:
+      case MPC_TYPE_AND:
+        
+        if (f->stage == 0) {
+          if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+          f->stage = 1;
+          f->j = 0;
+          f->base = s.vals_num;
+          mpc_input_mark(i);
+          MPC_CHILD(p->data.and.xs[0]);
+        }
+        
+        if (x) {
+          mpc_stack_value(&s, res);
+          f->j++;
+          if (f->j == p->data.and.n) {
+            mpc_input_unmark(i);
+            MPC_SUCCESS(mpc_stack_fold(i, &s, f->base, p->data.and.f));
+          }
+          MPC_CHILD(p->data.and.xs[f->j]);
+        }
+        
+        mpc_input_rewind(i);
+        for (k = 0; k < f->j; k++) {
+          mpc_parse_dtor(i, p->data.and.dxs[k], s.vals[f->base + k].output);
+        }
+        s.vals_num = f->base;
+        MPC_FAILURE(res.error);
       
-      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+      /* Frames */
       
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+      /*
+      ** Errors merged into the accumulator along the 
+      ** way are kept too, so a remembered parse reports
+      ** the same errors as running it again would.
+      ** Entries made while errors were suppressed have
+      ** no errors in them so they are only any use 
+      ** while errors are still suppressed.
+      **
+      ** A success is first remembered without its
+      ** result, which goes on to the caller. Copying it
+      ** then would copy every level of a deeply nested
+      ** tree again at each level above it. Only if it
+      ** is asked for again is it parsed again, with the
+      ** entries under it doing the work and its errors
+      ** already known, and a copy of the result kept.
+      ** After that the parser's successes are copied
+      ** straight away, since a grammar that asks twice
+      ** for one of them tends to ask for the rest too.
+      ** Whatever doesn't fit in the table's bytes is
+      ** left out and that parse is just run again.
+      */
       
-      mpc_input_mark(i);
-      for (j = 0; j < p->data.and.n; j++) {
-        if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e)) {
-          mpc_input_rewind(i);
-          for (k = 0; k < j; k++) {
-            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
+      case MPC_FRAME_MEMO:
+        
+        if (f->stage == 0) {
+        
+          m = mpc_input_memo_slot(i, p, i->pos);
+          if (m->p == p && m->pos == i->pos && m->start_last == i->last
+          &&  (m->errors || i->suppress)) {
+            if (m->merged && !i->suppress) { *acc = mpc_err_merge(i, *acc, mpc_err_copy(i, m->merged)); }
+            if (m->success) { *mpc_input_reasked_slot(i, p) = p; }
+            if (m->success && !m->kept) {
+              f->start = i->pos;
+              f->start_last = i->last;
+              f->local = NULL;
+              f->stage = 2;
+              MPC_CALL(p, p->type, s.num - 1);
+            }
+            i->pos = m->end;
+            i->last = m->last;
+            if (m->success) {
+              MPC_SUCCESS(m->output ? p->memo_copy(m->output) : NULL);
+            } else {
+              MPC_FAILURE(i->suppress ? NULL : mpc_err_copy(i, m->error));
+            }
           }
-          MPC_FAILURE(results[j].error;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+        
+          f->start = i->pos;
+          f->start_last = i->last;
+          f->local = NULL;
+          f->stage = 1;
+          MPC_CALL(p, p->type, s.num - 1);
         }
-      }
-      mpc_input_unmark(i); 
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-    
-    /* End */
-    
-    default:
+        
+        if (f->stage == 2) {
+          mpc_err_delete_internal(i, f->local);
+          m = mpc_input_memo_slot(i, p, f->start);
+          if (x && !s.overflow && m->p == p && m->pos == f->start && m->start_last == f->start_last) {
+            mpc_input_memo_keep(i, m, p, res.output, f->start);
+          }
+          s.num--;
+          continue;
+        }
+        
+        /* Without a copy function there's no way to hand a success out twice */
+        /* and a parse cut short by the depth limit might not fail next time */
+        if ((x && !p->memo_copy) || s.overflow) {
+          if (f->local) { *acc = mpc_err_merge(i, *acc, f->local); }
+          s.num--;
+          continue;
+        }
+        
+        /* The parse may have used the slot itself, so it is only taken now */
+        m = mpc_input_memo_slot(i, p, f->start);
+        mpc_input_memo_clear(i, m);
+        m->p = p;
+        m->pos = f->start;
+        m->start_last = f->start_last;
+        m->errors = !i->suppress && mpc_input_memo_fits(i, m,
+          mpc_input_memo_err_bytes(f->local) + (x ? 0 : mpc_input_memo_err_bytes(res.error)));
+        if (f->local) {
+          if (m->errors) { m->merged = mpc_err_export(i, mpc_err_copy(i, f->local)); }
+          *acc = mpc_err_merge(i, *acc, f->local);
+        }
+        m->success = x;
+        m->end = i->pos;
+        m->last = i->last;
+        if (x && *mpc_input_reasked_slot(i, p) == p) {
+          mpc_input_memo_keep(i, m, p, res.output, f->start);
+        }
+        if (!x && m->errors) {
+          m->error = res.error ? mpc_err_export(i, mpc_err_copy(i, res.error)) : NULL;
+        }
+        
+        s.num--;
+        continue;
+      
+      /* An `or` alternative run only to find out what it expects */
+      
+      case MPC_FRAME_SKIP:
+        
+        if (f->stage == 0) {
+          f->j = s.frames[s.num-2].j;
+          f->start = i->pos;
+          f->local = NULL;
+          f->stage = 1;
+          MPC_CALL(p->data.or.xs[f->j], mpc_frame_type(i, p->data.or.xs[f->j]), s.num - 1);
+        }
+        
+        if (x) {
+          *acc = mpc_err_merge(i, *acc, f->local);
+          MPC_SUCCESS(res.output);
+        }
+        
+        f->local = mpc_err_merge(i, f->local, res.error);
+        if (i->pos == f->start && !s.overflow) {
+          sk = mpc_input_skip_slot(i, p, f->j);
+          mpc_err_delete_internal(i, sk->error);
+          sk->p = p;
+          sk->j = f->j;
+          sk->error = f->local ? mpc_err_export(i, mpc_err_copy(i, f->local)) : NULL;
+        }
+        *acc = mpc_err_merge(i, *acc, f->local);
+        MPC_FAILURE(NULL);
+      
+      /* End */
       
-      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+      default:
+        
+        x = mpc_parse_leaf(i, p, &res, acc);
+        if (x < 0) { MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!")); }
+        s.num--;
+        continue;
+    }
   }
   
-  return 0;
+  free(s.frames);
+  free(s.vals);
+  
+  /*
+  ** Going past the depth limit ends the whole parse,
+  ** with only the error at the point it was passed.
+  ** Parsers that succeed on failure, like `many`,
+  ** can still hand a value up to the root, which is
+  ** destroyed with the root's destructor if it has
+  ** one.
+  */
+  
+  if (i->aborted) {
+    if (x && root->dtor) { mpc_parse_dtor(i, root->dtor, res.output); }
+    if (!x) { mpc_err_delete_internal(i, res.error); }
+    mpc_err_delete_internal(i, *e);
+    *e = NULL;
+    x = 0;
+    res.error = mpc_err_fail(i, "Maximum Parser Depth Exceeded!");
+    if (res.error) { res.error->state = mpc_state_pos(s.abort); }
+  }
   
+  *r = res;
+  return x;
 }
 
 #undef MPC_SUCCESS
 #undef MPC_FAILURE
-#undef MPC_PRIMITIVE
+#undef MPC_CALL
+#undef MPC_CHILD
+
+/*
+** With 'mpc_two_pass' strings and maps are first
+** parsed with errors suppressed, as on success
+** every one built would be thrown away. Only if that fails is the parse
+** run again from the start to say what went wrong.
+** Memo entries and the arena from the first go
+** are dropped so nothing of it leaks into the next.
+*/
+
+static void mpc_parse_restart(mpc_input_t *i, long pos, char last) {
+  i->pos = pos;
+  i->last = last;
+  if (i->memo) { mpc_input_memo_delete(i); }
+  if (i->arena) { mpc_ast_arena_delete(i->arena); i->arena = NULL; }
+}
 
 int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
-  int x;
-  mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
-  e->state = mpc_state_invalid();
-  x = mpc_parse_run(i, p, r, &e);
+  
+  int x = 0;
+  mpc_err_t *e = NULL;
+  long pos = i->pos;
+  char last = i->last;
+  
+  if (p->two_pass && (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP)) {
+    mpc_input_suppress_enable(i);
+    x = mpc_parse_run(i, p, r, &e);
+    mpc_input_suppress_disable(i);
+    if (!x) { mpc_parse_restart(i, pos, last); }
+  }
+  
+  if (!x) {
+    e = mpc_err_fail(i, "Unknown Error");
+    e->state = mpc_state_invalid();
+    x = mpc_parse_run(i, p, r, &e);
+  }
+  
   if (x) {
     mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
   } else {
-    r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
+    r->error = mpc_err_finish(i, mpc_err_merge(i, e, r->error));
+  }
+  /* Kept trees can be in the arena, so the table goes with it */
+  if (i->memo) { mpc_input_memo_delete(i); }
+  if (i->arena) {
+    mpc_ast_arena_finish(i->arena, x ? r->output : NULL);
+    i->arena = NULL;
   }
   return x;
 }
@@ -1299,6 +2873,14 @@ int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result
   return x;
 }
 
+int mpc_parse_mmap(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_mmap(filename, file);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
+}
+
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_pipe(filename, pipe);
@@ -1318,7 +2900,7 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
     return 0;
   }
   
-  res = mpc_parse_file(filename, f, p, r);
+  res = mpc_parse_mmap(filename, f, p, r);
   fclose(f);
   return res;
 }
@@ -1329,6 +2911,13 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
 
 static void mpc_undefine_unretained(mpc_parser_t *p, int force);
 
+static void mpc_undefine_or_dispatch(mpc_parser_t *p) {
+  
+  free(p->data.or.dispatch);
+  p->data.or.dispatch = NULL;
+  
+}
+
 static void mpc_undefine_or(mpc_parser_t *p) {
   
   int i;
@@ -1336,6 +2925,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
   free(p->data.or.xs);
+  mpc_undefine_or_dispatch(p);
   
 }
 
@@ -1350,6 +2940,33 @@ static void mpc_undefine_and(mpc_parser_t *p) {
   
 }
 
+static void mpc_undefine_dfa(mpc_parser_t *p) {
+  
+  int i;
+  
+  for (i = 0; i < p->data.dfa.n; i++) { free(p->data.dfa.expected[i]); }
+  free(p->data.dfa.expected);
+  free(p->data.dfa.accept);
+  free(p->data.dfa.next);
+  free(p->data.dfa.map);
+  
+}
+
+static void mpc_undefine_trie(mpc_parser_t *p) {
+  
+  int i;
+  
+  for (i = 0; i < p->data.trie.n; i++) {
+    free(p->data.trie.xs[i]);
+    free(p->data.trie.ms[i]);
+  }
+  free(p->data.trie.xs);
+  free(p->data.trie.ms);
+  free(p->data.trie.next);
+  free(p->data.trie.map);
+  
+}
+
 static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
   
   if (p->retained && !force) { return; }
@@ -1360,6 +2977,10 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     
     case MPC_TYPE_ONEOF: 
     case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SKIP:
+      free(p->data.oneof.x); 
+      break;
+    
     case MPC_TYPE_STRING:
       free(p->data.string.x); 
       break;
@@ -1367,6 +2988,7 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    case MPC_TYPE_SPAN:     mpc_undefine_unretained(p->data.span.x, 0);     break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1396,6 +3018,9 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
       mpc_undefine_unretained(p->data.check_with.x, 0);
       free(p->data.check_with.e);
       break;
+    
+    case MPC_TYPE_DFA:  mpc_undefine_dfa(p);  break;
+    case MPC_TYPE_TRIE: mpc_undefine_trie(p); break;
 
     default: break;
   }
@@ -1452,6 +3077,14 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
   p->retained = a->retained;
   p->type = a->type;
   p->data = a->data;
+  p->id = a->id;
+  p->action = a->action;
+  p->dtor = a->dtor;
+  p->memo = a->memo;
+  p->memo_copy = a->memo_copy;
+  p->memo_dtor = a->memo_dtor;
+  p->depth_max = a->depth_max;
+  p->two_pass = a->two_pass;
   
   if (a->name) {
     p->name = malloc(strlen(a->name)+1);
@@ -1467,6 +3100,11 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
     
     case MPC_TYPE_ONEOF: 
     case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SKIP:
+      p->data.oneof.x = malloc(strlen(a->data.oneof.x)+1);
+      strcpy(p->data.oneof.x, a->data.oneof.x);
+      break;
+    
     case MPC_TYPE_STRING:
       p->data.string.x = malloc(strlen(a->data.string.x)+1);
       strcpy(p->data.string.x, a->data.string.x);
@@ -1475,6 +3113,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
     case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
     case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
     case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    case MPC_TYPE_SPAN:     p->data.span.x     = mpc_copy(a->data.span.x);     break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1498,6 +3137,10 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       for (i = 0; i < a->data.or.n; i++) {
         p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
       }
+      if (a->data.or.dispatch) {
+        p->data.or.dispatch = malloc(257 * ((a->data.or.n + 7) / 8));
+        memcpy(p->data.or.dispatch, a->data.or.dispatch, 257 * ((a->data.or.n + 7) / 8));
+      }
     break;
     case MPC_TYPE_AND:
       p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
@@ -1520,6 +3163,35 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       p->data.check_with.e = malloc(strlen(a->data.check_with.e)+1);
       strcpy(p->data.check_with.e, a->data.check_with.e);
       break;
+    
+    case MPC_TYPE_DFA:
+      p->data.dfa.map = malloc(256);
+      memcpy(p->data.dfa.map, a->data.dfa.map, 256);
+      p->data.dfa.next = malloc(sizeof(int) * a->data.dfa.n * a->data.dfa.classes);
+      memcpy(p->data.dfa.next, a->data.dfa.next, sizeof(int) * a->data.dfa.n * a->data.dfa.classes);
+      p->data.dfa.accept = malloc(a->data.dfa.n);
+      memcpy(p->data.dfa.accept, a->data.dfa.accept, a->data.dfa.n);
+      p->data.dfa.expected = malloc(sizeof(char*) * a->data.dfa.n);
+      for (i = 0; i < a->data.dfa.n; i++) {
+        p->data.dfa.expected[i] = NULL;
+        if (a->data.dfa.expected[i]) {
+          p->data.dfa.expected[i] = malloc(strlen(a->data.dfa.expected[i])+1);
+          strcpy(p->data.dfa.expected[i], a->data.dfa.expected[i]);
+        }
+      }
+      break;
+    
+    case MPC_TYPE_TRIE:
+      p->data.trie.xs = malloc(sizeof(char*) * a->data.trie.n);
+      p->data.trie.ms = malloc(sizeof(char*) * a->data.trie.n);
+      for (i = 0; i < a->data.trie.n; i++) {
+        p->data.trie.xs[i] = malloc(strlen(a->data.trie.xs[i])+1);
+        strcpy(p->data.trie.xs[i], a->data.trie.xs[i]);
+        p->data.trie.ms[i] = malloc(strlen(a->data.trie.ms[i])+1);
+        strcpy(p->data.trie.ms[i], a->data.trie.ms[i]);
+      }
+      mpc_trie_build(&p->data.trie);
+      break;
 
     default: break;
   }
@@ -1719,20 +3391,37 @@ mpc_parser_t *mpc_range(char s, char e) {
 mpc_parser_t *mpc_oneof(const char *s) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_ONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
+  p->data.oneof.x = malloc(strlen(s) + 1);
+  strcpy(p->data.oneof.x, s);
+  mpc_class_init(p->data.oneof.set, s, 0);
   return mpc_expectf(p, "one of '%s'", s);
 }
 
 mpc_parser_t *mpc_noneof(const char *s) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
+  p->data.oneof.x = malloc(strlen(s) + 1);
+  strcpy(p->data.oneof.x, s);
+  mpc_class_init(p->data.oneof.set, s, 1);
   return mpc_expectf(p, "none of '%s'", s);
 
 }
 
+/*
+** Skips over any run of the characters in `s`
+** and always succeeds, without making a value
+** or any errors along the way.
+*/
+
+static mpc_parser_t *mpc_skip(const char *s) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_SKIP;
+  p->data.oneof.x = malloc(strlen(s) + 1);
+  strcpy(p->data.oneof.x, s);
+  mpc_class_init(p->data.oneof.set, s, 0);
+  return p;
+}
+
 mpc_parser_t *mpc_satisfy(int(*f)(char)) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_SATISFY;
@@ -1829,6 +3518,30 @@ mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
   return p;
 }
 
+mpc_parser_t *mpc_span(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_SPAN;
+  p->data.span.x = a;
+  return p;
+}
+
+mpc_parser_t *mpc_memoize(mpc_parser_t *a, mpc_copy_t copy, mpc_dtor_t da) {
+  a->memo = 1;
+  a->memo_copy = copy;
+  a->memo_dtor = da;
+  return a;
+}
+
+mpc_parser_t *mpc_max_depth(mpc_parser_t *a, int n) {
+  a->depth_max = n;
+  return a;
+}
+
+mpc_parser_t *mpc_two_pass(mpc_parser_t *a) {
+  a->two_pass = 1;
+  return a;
+}
+
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NOT;
@@ -1950,7 +3663,7 @@ mpc_parser_t *mpc_boundary(void) { return mpc_expect(mpc_anchor(mpc_boundary_anc
 
 mpc_parser_t *mpc_whitespace(void) { return mpc_expect(mpc_oneof(" \f\n\r\t\v"), "whitespace"); }
 mpc_parser_t *mpc_whitespaces(void) { return mpc_expect(mpc_many(mpcf_strfold, mpc_whitespace()), "spaces"); }
-mpc_parser_t *mpc_blank(void) { return mpc_expect(mpc_apply(mpc_whitespaces(), mpcf_free), "whitespace"); }
+mpc_parser_t *mpc_blank(void) { return mpc_expect(mpc_skip(" \f\n\r\t\v"), "whitespace"); }
 
 mpc_parser_t *mpc_newline(void) { return mpc_expect(mpc_char('\n'), "newline"); }
 mpc_parser_t *mpc_tab(void) { return mpc_expect(mpc_char('\t'), "tab"); }
@@ -1967,7 +3680,7 @@ mpc_parser_t *mpc_lower(void) { return mpc_expect(mpc_oneof("abcdefghijklmnopqrs
 mpc_parser_t *mpc_upper(void) { return mpc_expect(mpc_oneof("ABCDEFGHIJKLMNOPQRSTUVWXYZ"), "uppercase letter"); }
 mpc_parser_t *mpc_alpha(void) { return mpc_expect(mpc_oneof("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"), "letter"); }
 mpc_parser_t *mpc_underscore(void) { return mpc_expect(mpc_char('_'), "underscore"); }
-mpc_parser_t *mpc_alphanum(void) { return mpc_expect(mpc_or(3, mpc_alpha(), mpc_digit(), mpc_underscore()), "alphanumeric"); }
+mpc_parser_t *mpc_alphanum(void) { return mpc_expect(mpc_oneof("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_"), "alphanumeric"); }
 
 mpc_parser_t *mpc_int(void) { return mpc_expect(mpc_apply(mpc_digits(), mpcf_int), "integer"); }
 mpc_parser_t *mpc_hex(void) { return mpc_expect(mpc_apply(mpc_hexdigits(), mpcf_hex), "hexadecimal"); }
@@ -1988,7 +3701,7 @@ mpc_parser_t *mpc_real(void) {
   p32 = mpc_digits();
   p3 = mpc_maybe_lift(mpc_and(3, mpcf_strfold, p30, p31, p32, free, free), mpcf_ctor_str);
   
-  return mpc_expect(mpc_and(4, mpcf_strfold, p0, p1, p2, p3, free, free, free), "real");
+  return mpc_expect(mpc_span(mpc_and(4, mpcf_strfold, p0, p1, p2, p3, free, free, free)), "real");
 
 }
 
@@ -1997,24 +3710,24 @@ mpc_parser_t *mpc_float(void) {
 }
 
 mpc_parser_t *mpc_char_lit(void) {
-  return mpc_expect(mpc_between(mpc_or(2, mpc_escape(), mpc_any()), free, "'", "'"), "char");
+  return mpc_expect(mpc_between(mpc_span(mpc_or(2, mpc_escape(), mpc_any())), free, "'", "'"), "char");
 }
 
 mpc_parser_t *mpc_string_lit(void) {
   mpc_parser_t *strchar = mpc_or(2, mpc_escape(), mpc_noneof("\""));
-  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, strchar), free, "\"", "\""), "string");
+  return mpc_expect(mpc_between(mpc_span(mpc_many(mpcf_strfold, strchar)), free, "\"", "\""), "string");
 }
 
 mpc_parser_t *mpc_regex_lit(void) {  
   mpc_parser_t *regexchar = mpc_or(2, mpc_escape(), mpc_noneof("/"));
-  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, regexchar), free, "/", "/"), "regex");
+  return mpc_expect(mpc_between(mpc_span(mpc_many(mpcf_strfold, regexchar)), free, "/", "/"), "regex");
 }
 
 mpc_parser_t *mpc_ident(void) {
   mpc_parser_t *p0, *p1; 
   p0 = mpc_or(2, mpc_alpha(), mpc_underscore());
   p1 = mpc_many(mpcf_strfold, mpc_alphanum()); 
-  return mpc_and(2, mpcf_strfold, p0, p1, free);
+  return mpc_span(mpc_and(2, mpcf_strfold, p0, p1, free));
 }
 
 /*
@@ -2200,19 +3913,19 @@ static const char *mpc_re_range_escape_char(char c) {
   }
 }
 
-static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+static char *mpc_re_range_string(const char *s) {
   
-  mpc_parser_t *out;
   size_t i, j;
   size_t start, end;
   const char *tmp = NULL;
-  const char *s = x;
   int comp = s[0] == '^' ? 1 : 0;
-  char *range = calloc(1,1);
+  char *range;
   
-  if (s[0] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); } 
+  if (s[0] == '\0') { return NULL; } 
   if (s[0] == '^' && 
-      s[1] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
+      s[1] == '\0') { return NULL; }
+  
+  range = calloc(1,1);
   
   for (i = comp; i < strlen(s); i++){
     
@@ -2255,6 +3968,18 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   
   }
   
+  return range;
+}
+
+static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+  
+  mpc_parser_t *out;
+  const char *s = x;
+  int comp = s[0] == '^' ? 1 : 0;
+  char *range = mpc_re_range_string(s);
+  
+  if (range == NULL) { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+  
   out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
   
   free(x);
@@ -2263,58 +3988,576 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
-mpc_parser_t *mpc_re(const char *re) {
-  
-  char *err_msg;
-  mpc_parser_t *err_out;
-  mpc_result_t r;
-  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose; 
-  
-  Regex  = mpc_new("regex");
-  Term   = mpc_new("term");
-  Factor = mpc_new("factor");
-  Base   = mpc_new("base");
-  Range  = mpc_new("range");
-  
-  mpc_define(Regex, mpc_and(2, mpcf_re_or,
-    Term, 
-    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, free)),
-    (mpc_dtor_t)mpc_delete
-  ));
-  
-  mpc_define(Term, mpc_many(mpcf_re_and, Factor));
-  
-  mpc_define(Factor, mpc_and(2, mpcf_re_repeat,
-    Base,
-    mpc_or(5,
-      mpc_char('*'), mpc_char('+'), mpc_char('?'),
-      mpc_brackets(mpc_int(), free),
-      mpc_pass()),
-    (mpc_dtor_t)mpc_delete
-  ));
-  
-  mpc_define(Base, mpc_or(4,
-    mpc_parens(Regex, (mpc_dtor_t)mpc_delete),
-    mpc_squares(Range, (mpc_dtor_t)mpc_delete),
-    mpc_apply(mpc_escape(), mpcf_re_escape),
-    mpc_apply(mpc_noneof(")|"), mpcf_re_escape)
-  ));
-  
-  mpc_define(Range, mpc_apply(
-    mpc_many(mpcf_strfold, mpc_or(2, mpc_escape(), mpc_noneof("]"))),
-    mpcf_re_range
-  ));
-  
-  RegexEnclose = mpc_whole(mpc_predictive(Regex), (mpc_dtor_t)mpc_delete);
-  
-  mpc_optimise(RegexEnclose);
+/*
+** Regular Expression Automata
+**
+** Most regular expressions used for tokens only ever
+** have one way to go given the next character. For
+** those the parsers built above match exactly the
+** same text as the longest match of a DFA, so they
+** are compiled into one instead. Anything else, such
+** as anchors, the negated classes, or choices which
+** need more than a character of lookahead, is still
+** built out of parsers.
+**
+** The expression is parsed with the same grammar into
+** a small tree, which is checked and then turned into
+** a position automaton and from there into a DFA with
+** the usual subset construction. Characters which
+** every position treats alike share a column of the
+** transition table.
+*/
+
+enum {
+  MPC_RE_NONE  = 0,
+  MPC_RE_EMPTY = 1,
+  MPC_RE_SET   = 2,
+  MPC_RE_AND   = 3,
+  MPC_RE_OR    = 4,
+  MPC_RE_MANY  = 5,
+  MPC_RE_MANY1 = 6,
+  MPC_RE_MAYBE = 7
+};
+
+enum {
+  MPC_RE_POSITIONS_MAX = 256,
+  MPC_RE_STATES_MAX    = 1024
+};
+
+typedef struct { unsigned char x[32]; } mpc_re_set_t;
+
+typedef struct mpc_re_node_t {
+  int type;
+  int pos;
+  int nullable;
+  mpc_re_set_t set;
+  mpc_re_set_t first;
+  mpc_re_set_t last;
+  struct mpc_re_node_t *a;
+  struct mpc_re_node_t *b;
+} mpc_re_node_t;
+
+static int mpc_re_set_has(const mpc_re_set_t *s, int c) { return (s->x[c >> 3] >> (c & 7)) & 1; }
+static void mpc_re_set_add(mpc_re_set_t *s, int c) { s->x[c >> 3] |= 1 << (c & 7); }
+
+static void mpc_re_set_union(mpc_re_set_t *s, const mpc_re_set_t *t) {
+  int j;
+  for (j = 0; j < 32; j++) { s->x[j] |= t->x[j]; }
+}
+
+static int mpc_re_set_meets(const mpc_re_set_t *s, const mpc_re_set_t *t) {
+  int j;
+  for (j = 0; j < 32; j++) { if (s->x[j] & t->x[j]) { return 1; } }
+  return 0;
+}
+
+static mpc_re_node_t *mpc_re_node_new(int type, mpc_re_node_t *a, mpc_re_node_t *b) {
+  mpc_re_node_t *n = calloc(1, sizeof(mpc_re_node_t));
+  n->type = type;
+  n->a = a;
+  n->b = b;
+  return n;
+}
+
+static void mpc_re_node_delete(mpc_val_t *x) {
+  mpc_re_node_t *n = x;
+  if (n == NULL) { return; }
+  mpc_re_node_delete(n->a);
+  mpc_re_node_delete(n->b);
+  free(n);
+}
+
+/* Anything unsupported poisons the whole expression */
+static mpc_re_node_t *mpc_re_node_join(int type, mpc_re_node_t *a, mpc_re_node_t *b) {
+  if (a->type == MPC_RE_NONE || (b && b->type == MPC_RE_NONE)) {
+    mpc_re_node_delete(a);
+    mpc_re_node_delete(b);
+    return mpc_re_node_new(MPC_RE_NONE, NULL, NULL);
+  }
+  return mpc_re_node_new(type, a, b);
+}
+
+/* Sets as matched by `mpc_oneof`, which also accepts a null byte */
+static mpc_re_node_t *mpc_re_node_oneof(const char *s) {
+  mpc_re_node_t *n = mpc_re_node_new(MPC_RE_SET, NULL, NULL);
+  while (*s) { mpc_re_set_add(&n->set, (unsigned char)*s); s++; }
+  mpc_re_set_add(&n->set, 0);
+  return n;
+}
+
+static mpc_re_node_t *mpc_re_node_char(char c) {
+  mpc_re_node_t *n = mpc_re_node_new(MPC_RE_SET, NULL, NULL);
+  mpc_re_set_add(&n->set, (unsigned char)c);
+  return n;
+}
+
+static mpc_val_t *mpcf_re_node_or(int n, mpc_val_t **xs) {
+  (void) n;
+  if (xs[1] == NULL) { return xs[0]; }
+  else { return mpc_re_node_join(MPC_RE_OR, xs[0], xs[1]); }
+}
+
+static mpc_val_t *mpcf_re_node_and(int n, mpc_val_t **xs) {
+  int i;
+  mpc_re_node_t *p = mpc_re_node_new(MPC_RE_EMPTY, NULL, NULL);
+  for (i = 0; i < n; i++) {
+    p = mpc_re_node_join(MPC_RE_AND, p, xs[i]);
+  }
+  return p;
+}
+
+static mpc_val_t *mpcf_re_node_repeat(int n, mpc_val_t **xs) {
+  int num;
+  (void) n;
+  if (xs[1] == NULL) { return xs[0]; }
+  switch(((char*)xs[1])[0])
+  {
+    case '*': { free(xs[1]); return mpc_re_node_join(MPC_RE_MANY, xs[0], NULL); }; break;
+    case '+': { free(xs[1]); return mpc_re_node_join(MPC_RE_MANY1, xs[0], NULL); }; break;
+    case '?': { free(xs[1]); return mpc_re_node_join(MPC_RE_MAYBE, xs[0], NULL); }; break;
+    default:
+      num = *(int*)xs[1];
+      free(xs[1]);
+  }
+  
+  /*
+  ** `mpc_count` can't match zero times, and when it fails
+  ** part of the way through it doesn't give back what it
+  ** read, so `(c{2}|a)` matches the "a" of "ca". A DFA
+  ** can't do either, so leave all but one time to it.
+  */
+  if (num != 1) {
+    mpc_re_node_delete(xs[0]);
+    return mpc_re_node_new(MPC_RE_NONE, NULL, NULL);
+  }
+  
+  return xs[0];
+}
+
+static mpc_val_t *mpcf_re_node_escape(mpc_val_t *x) {
+  
+  char *s = x;
+  mpc_re_node_t *p;
+  int c;
+  
+  if (s[0] == '.') {
+    p = mpc_re_node_new(MPC_RE_SET, NULL, NULL);
+    memset(p->set.x, 0xFF, sizeof(p->set.x));
+    free(s);
+    return p;
+  }
+  
+  if (s[0] == '^' || s[0] == '$') {
+    free(s);
+    return mpc_re_node_new(MPC_RE_NONE, NULL, NULL);
+  }
+  
+  if (s[0] == '\\') {
+    switch (s[1]) {
+      case 'a': p = mpc_re_node_char('\a'); break;
+      case 'f': p = mpc_re_node_char('\f'); break;
+      case 'n': p = mpc_re_node_char('\n'); break;
+      case 'r': p = mpc_re_node_char('\r'); break;
+      case 't': p = mpc_re_node_char('\t'); break;
+      case 'v': p = mpc_re_node_char('\v'); break;
+      case 'd': p = mpc_re_node_oneof(mpc_re_range_escape_char('d')); break;
+      case 's': p = mpc_re_node_oneof(mpc_re_range_escape_char('s')); break;
+      case 'w': p = mpc_re_node_oneof(mpc_re_range_escape_char('w')); break;
+      case 'b': case 'B': case 'A': case 'Z':
+      case 'D': case 'S': case 'W':
+        p = mpc_re_node_new(MPC_RE_NONE, NULL, NULL);
+        break;
+      default: p = mpc_re_node_char(s[1]);
+    }
+    free(s);
+    return p;
+  }
+  
+  c = s[0];
+  free(s);
+  return mpc_re_node_char(c);
+}
+
+static mpc_val_t *mpcf_re_node_range(mpc_val_t *x) {
+  
+  int c;
+  mpc_re_node_t *p;
+  const char *s = x;
+  int comp = s[0] == '^' ? 1 : 0;
+  char *range = mpc_re_range_string(x);
+  
+  if (range == NULL) { free(x); return mpc_re_node_new(MPC_RE_NONE, NULL, NULL); }
+  
+  p = mpc_re_node_oneof(range);
+  
+  /* `mpc_noneof` on the other hand never accepts a null byte */
+  if (comp) {
+    for (c = 0; c < 32; c++) { p->set.x[c] = ~p->set.x[c]; }
+  }
+  
+  free(x);
+  free(range);
+  
+  return p;
+}
+
+static int mpc_re_node_positions(mpc_re_node_t *n, mpc_re_node_t **leaves, int num) {
+  if (n == NULL) { return num; }
+  if (n->type == MPC_RE_SET) {
+    if (num < MPC_RE_POSITIONS_MAX) { leaves[num] = n; }
+    n->pos = num;
+    return num + 1;
+  }
+  num = mpc_re_node_positions(n->a, leaves, num);
+  return mpc_re_node_positions(n->b, leaves, num);
+}
+
+static void mpc_re_node_follow(mpc_re_node_t *n, mpc_re_set_t *follow) {
+  
+  int j;
+  
+  if (n == NULL) { return; }
+  
+  mpc_re_node_follow(n->a, follow);
+  mpc_re_node_follow(n->b, follow);
+  
+  switch (n->type) {
+    case MPC_RE_EMPTY:
+      n->nullable = 1;
+      break;
+    case MPC_RE_SET:
+      mpc_re_set_add(&n->first, n->pos);
+      mpc_re_set_add(&n->last, n->pos);
+      break;
+    case MPC_RE_AND:
+      n->nullable = n->a->nullable && n->b->nullable;
+      n->first = n->a->first;
+      if (n->a->nullable) { mpc_re_set_union(&n->first, &n->b->first); }
+      n->last = n->b->last;
+      if (n->b->nullable) { mpc_re_set_union(&n->last, &n->a->last); }
+      for (j = 0; j < MPC_RE_POSITIONS_MAX; j++) {
+        if (mpc_re_set_has(&n->a->last, j)) { mpc_re_set_union(&follow[j], &n->b->first); }
+      }
+      break;
+    case MPC_RE_OR:
+      n->nullable = n->a->nullable || n->b->nullable;
+      n->first = n->a->first;
+      mpc_re_set_union(&n->first, &n->b->first);
+      n->last = n->a->last;
+      mpc_re_set_union(&n->last, &n->b->last);
+      break;
+    case MPC_RE_MANY:
+    case MPC_RE_MANY1:
+    case MPC_RE_MAYBE:
+      n->nullable = n->type != MPC_RE_MANY1 || n->a->nullable;
+      n->first = n->a->first;
+      n->last = n->a->last;
+      if (n->type == MPC_RE_MAYBE) { break; }
+      for (j = 0; j < MPC_RE_POSITIONS_MAX; j++) {
+        if (mpc_re_set_has(&n->a->last, j)) { mpc_re_set_union(&follow[j], &n->a->first); }
+      }
+      break;
+  }
+  
+}
+
+static mpc_re_set_t mpc_re_chars(mpc_re_node_t **leaves, const mpc_re_set_t *positions) {
+  int j;
+  mpc_re_set_t s;
+  memset(&s, 0, sizeof(s));
+  for (j = 0; j < MPC_RE_POSITIONS_MAX; j++) {
+    if (mpc_re_set_has(positions, j)) { mpc_re_set_union(&s, &leaves[j]->set); }
+  }
+  return s;
+}
+
+/*
+** Checks that every choice can be made by looking at
+** the next character, given the characters `ctx` which
+** may come after the node. Greedy repetition and
+** ordered choice then find the same match as the DFA.
+*/
+
+static int mpc_re_node_ll1(mpc_re_node_t *n, mpc_re_node_t **leaves, mpc_re_set_t ctx) {
+  
+  mpc_re_set_t fa, fb, inner;
+  
+  switch (n->type) {
+    case MPC_RE_EMPTY:
+    case MPC_RE_SET:
+      return 1;
+    case MPC_RE_AND:
+      inner = mpc_re_chars(leaves, &n->b->first);
+      if (n->b->nullable) { mpc_re_set_union(&inner, &ctx); }
+      return mpc_re_node_ll1(n->a, leaves, inner) && mpc_re_node_ll1(n->b, leaves, ctx);
+    case MPC_RE_OR:
+      fa = mpc_re_chars(leaves, &n->a->first);
+      fb = mpc_re_chars(leaves, &n->b->first);
+      if (n->a->nullable || mpc_re_set_meets(&fa, &fb)) { return 0; }
+      if (n->b->nullable && (mpc_re_set_meets(&fa, &ctx) || mpc_re_set_meets(&fb, &ctx))) { return 0; }
+      return mpc_re_node_ll1(n->a, leaves, ctx) && mpc_re_node_ll1(n->b, leaves, ctx);
+    case MPC_RE_MANY:
+    case MPC_RE_MANY1:
+    case MPC_RE_MAYBE:
+      fa = mpc_re_chars(leaves, &n->a->first);
+      if (n->a->nullable || mpc_re_set_meets(&fa, &ctx)) { return 0; }
+      inner = ctx;
+      if (n->type != MPC_RE_MAYBE) { mpc_re_set_union(&inner, &fa); }
+      return mpc_re_node_ll1(n->a, leaves, inner);
+    default:
+      return 0;
+  }
+  
+}
+
+static char *mpc_re_dfa_expected(const mpc_re_set_t *live) {
+  
+  int c, num = 0, comp;
+  char buff[256];
+  char *e;
+  
+  for (c = 0; c < 256; c++) { num += mpc_re_set_has(live, c); }
+  
+  if (num == 0) { return NULL; }
+  
+  if (num == 256) {
+    e = malloc(strlen("any character") + 1);
+    strcpy(e, "any character");
+    return e;
+  }
+  
+  if (num == 1) {
+    for (c = 0; !mpc_re_set_has(live, c); c++);
+    e = malloc(4);
+    sprintf(e, "'%c'", c);
+    return e;
+  }
+  
+  comp = num > 128;
+  num = 0;
+  for (c = 1; c < 256; c++) {
+    if (mpc_re_set_has(live, c) != comp) { buff[num++] = (char)c; }
+  }
+  buff[num] = '\0';
+  
+  e = malloc(strlen("none of ''") + num + 1);
+  sprintf(e, comp ? "none of '%s'" : "one of '%s'", buff);
+  return e;
+}
+
+static mpc_parser_t *mpc_re_dfa(mpc_re_node_t *root) {
+  
+  int j, k, c, t, n, num, classes = 0, slots = 16;
+  mpc_re_node_t *leaves[MPC_RE_POSITIONS_MAX];
+  mpc_re_set_t sigs[256], live, from, to, none;
+  mpc_re_set_t *follow, *states;
+  unsigned char map[256];
+  char *accept, **expected;
+  int *next;
+  mpc_parser_t *p;
+  
+  if (root->type == MPC_RE_NONE) { return NULL; }
+  
+  num = mpc_re_node_positions(root, leaves, 0);
+  if (num > MPC_RE_POSITIONS_MAX) { return NULL; }
+  
+  follow = calloc(MPC_RE_POSITIONS_MAX, sizeof(mpc_re_set_t));
+  mpc_re_node_follow(root, follow);
+  
+  memset(&none, 0, sizeof(none));
+  if (!mpc_re_node_ll1(root, leaves, none)) {
+    free(follow);
+    return NULL;
+  }
+  
+  /* Characters go in the same class when every position agrees on them */
+  for (c = 0; c < 256; c++) {
+    memset(&sigs[classes], 0, sizeof(mpc_re_set_t));
+    for (j = 0; j < num; j++) {
+      if (mpc_re_set_has(&leaves[j]->set, c)) { mpc_re_set_add(&sigs[classes], j); }
+    }
+    for (k = 0; k < classes; k++) {
+      if (memcmp(&sigs[k], &sigs[classes], sizeof(mpc_re_set_t)) == 0) { break; }
+    }
+    map[c] = (unsigned char)k;
+    if (k == classes) { classes++; }
+  }
+  
+  states   = malloc(sizeof(mpc_re_set_t) * slots);
+  accept   = malloc(slots);
+  next     = malloc(sizeof(int) * slots * classes);
+  
+  states[0] = root->first;
+  accept[0] = (char)root->nullable;
+  n = 1;
+  
+  for (j = 0; j < n; j++) {
+    for (k = 0; k < classes; k++) {
+      
+      for (c = 0; c < 32; c++) { from.x[c] = states[j].x[c] & sigs[k].x[c]; }
+      
+      if (!mpc_re_set_meets(&from, &from)) {
+        next[j * classes + k] = -1;
+        continue;
+      }
+      
+      memset(&to, 0, sizeof(to));
+      for (c = 0; c < MPC_RE_POSITIONS_MAX; c++) {
+        if (mpc_re_set_has(&from, c)) { mpc_re_set_union(&to, &follow[c]); }
+      }
+      
+      for (t = 0; t < n; t++) {
+        if (accept[t] == mpc_re_set_meets(&from, &root->last)
+        &&  memcmp(&states[t], &to, sizeof(mpc_re_set_t)) == 0) { break; }
+      }
+      
+      if (t == n) {
+        
+        if (n == MPC_RE_STATES_MAX) {
+          free(follow); free(states); free(accept); free(next);
+          return NULL;
+        }
+        
+        if (n == slots) {
+          slots *= 2;
+          states = realloc(states, sizeof(mpc_re_set_t) * slots);
+          accept = realloc(accept, slots);
+          next   = realloc(next, sizeof(int) * slots * classes);
+        }
+        
+        states[n] = to;
+        accept[n] = (char)mpc_re_set_meets(&from, &root->last);
+        n++;
+      }
+      
+      next[j * classes + k] = t;
+    }
+  }
+  
+  /* What each state could have gone on to read, for errors */
+  expected = malloc(sizeof(char*) * n);
+  for (j = 0; j < n; j++) {
+    memset(&live, 0, sizeof(live));
+    for (c = 0; c < 256; c++) {
+      if (next[j * classes + map[c]] >= 0) { mpc_re_set_add(&live, c); }
+    }
+    expected[j] = mpc_re_dfa_expected(&live);
+  }
+  
+  free(follow);
+  free(states);
+  
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.n = n;
+  p->data.dfa.classes = classes;
+  p->data.dfa.map = malloc(256);
+  memcpy(p->data.dfa.map, map, 256);
+  p->data.dfa.next = realloc(next, sizeof(int) * n * classes);
+  p->data.dfa.accept = realloc(accept, n);
+  p->data.dfa.expected = expected;
+  return p;
+}
+
+typedef struct {
+  mpc_fold_t or;
+  mpc_fold_t and;
+  mpc_fold_t repeat;
+  mpc_apply_t escape;
+  mpc_apply_t range;
+  mpc_dtor_t dtor;
+} mpc_re_folds_t;
+
+static const mpc_re_folds_t mpc_re_parser_folds = {
+  mpcf_re_or, mpcf_re_and, mpcf_re_repeat,
+  mpcf_re_escape, mpcf_re_range, (mpc_dtor_t)mpc_delete
+};
+
+static const mpc_re_folds_t mpc_re_node_folds = {
+  mpcf_re_node_or, mpcf_re_node_and, mpcf_re_node_repeat,
+  mpcf_re_node_escape, mpcf_re_node_range, mpc_re_node_delete
+};
+
+static int mpc_re_parse(const char *re, const mpc_re_folds_t *f, mpc_result_t *r) {
+  
+  int x;
+  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose; 
+  
+  Regex  = mpc_new("regex");
+  Term   = mpc_new("term");
+  Factor = mpc_new("factor");
+  Base   = mpc_new("base");
+  Range  = mpc_new("range");
+  
+  mpc_define(Regex, mpc_and(2, f->or,
+    Term, 
+    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, free)),
+    f->dtor
+  ));
+  
+  mpc_define(Term, mpc_many(f->and, Factor));
+  
+  mpc_define(Factor, mpc_and(2, f->repeat,
+    Base,
+    mpc_or(5,
+      mpc_char('*'), mpc_char('+'), mpc_char('?'),
+      mpc_brackets(mpc_int(), free),
+      mpc_pass()),
+    f->dtor
+  ));
+  
+  mpc_define(Base, mpc_or(4,
+    mpc_parens(Regex, f->dtor),
+    mpc_squares(Range, f->dtor),
+    mpc_apply(mpc_escape(), f->escape),
+    mpc_apply(mpc_noneof(")|"), f->escape)
+  ));
+  
+  mpc_define(Range, mpc_apply(
+    mpc_many(mpcf_strfold, mpc_or(2, mpc_escape(), mpc_noneof("]"))),
+    f->range
+  ));
+  
+  RegexEnclose = mpc_whole(mpc_predictive(Regex), f->dtor);
+  
+  mpc_optimise(RegexEnclose);
   mpc_optimise(Regex);
   mpc_optimise(Term);
   mpc_optimise(Factor);
   mpc_optimise(Base);
   mpc_optimise(Range);
   
-  if(!mpc_parse("<mpc_re_compiler>", re, RegexEnclose, &r)) {
+  x = mpc_parse("<mpc_re_compiler>", re, RegexEnclose, r);
+  
+  mpc_cleanup(6, RegexEnclose, Regex, Term, Factor, Base, Range);
+  
+  return x;
+}
+
+mpc_parser_t *mpc_re(const char *re) {
+  
+  mpc_parser_t *dfa;
+  mpc_result_t r;
+  
+  if (mpc_re_parse(re, &mpc_re_node_folds, &r)) {
+    dfa = mpc_re_dfa(r.output);
+    mpc_re_node_delete(r.output);
+    if (dfa) { return dfa; }
+  } else {
+    mpc_err_delete(r.error);
+  }
+  
+  return mpc_re_predictive(re);
+  
+}
+
+mpc_parser_t *mpc_re_predictive(const char *re) {
+  
+  char *err_msg;
+  mpc_parser_t *err_out;
+  mpc_result_t r;
+  
+  if (!mpc_re_parse(re, &mpc_re_parser_folds, &r)) {
     err_msg = mpc_err_string(r.error);
     err_out = mpc_failf("Invalid Regex: %s", err_msg);
     mpc_err_delete(r.error);  
@@ -2322,8 +4565,6 @@ mpc_parser_t *mpc_re(const char *re) {
     r.output = err_out;
   }
   
-  mpc_cleanup(6, RegexEnclose, Regex, Term, Factor, Base, Range);
-  
   mpc_optimise(r.output);
   
   return r.output;
@@ -2614,6 +4855,12 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   
   if (p->type == MPC_TYPE_ANY) { printf("<.>"); }
   if (p->type == MPC_TYPE_SATISFY) { printf("<f>"); }
+  if (p->type == MPC_TYPE_DFA) { printf("<DFA %i>", p->data.dfa.n); }
+  
+  if (p->type == MPC_TYPE_TRIE) {
+    for (i = 0; i < p->data.trie.n-1; i++) { printf("%s | ", p->data.trie.ms[i]); }
+    printf("%s", p->data.trie.ms[p->data.trie.n-1]);
+  }
 
   if (p->type == MPC_TYPE_SINGLE) {
     buff[0] = p->data.single.x; buff[1] = '\0';
@@ -2643,7 +4890,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   
   if (p->type == MPC_TYPE_ONEOF) {
     s = mpcf_escape_new(
-      p->data.string.x,
+      p->data.oneof.x,
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[%s]", s);
@@ -2652,13 +4899,22 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   
   if (p->type == MPC_TYPE_NONEOF) {
     s = mpcf_escape_new(
-      p->data.string.x,
+      p->data.oneof.x,
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[^%s]", s);
     free(s);
   }
   
+  if (p->type == MPC_TYPE_SKIP) {
+    s = mpcf_escape_new(
+      p->data.oneof.x,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    printf("[%s]*", s);
+    free(s);
+  }
+  
   if (p->type == MPC_TYPE_STRING) {
     s = mpcf_escape_new(
       p->data.string.x,
@@ -2671,6 +4927,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)     { mpc_print_unretained(p->data.span.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2785,14 +5042,265 @@ int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
 ** AST
 */
 
-void mpc_ast_delete(mpc_ast_t *a) {
-  
-  int i;
-  
-  if (a == NULL) { return; }
-  
-  for (i = 0; i < a->children_num; i++) {
-    mpc_ast_delete(a->children[i]);
+/*
+** Trees made by a parse are kept in an arena
+** owned by the root. Nodes, strings and child
+** arrays are bumped out of its blocks and the 
+** whole lot goes in one go when the root is
+** deleted. Deleting any other node of it does
+** nothing. Heap nodes put into an arena tree
+** are counted in `foreign` so they can still be
+** found and freed, and arena nodes put into any
+** other tree are copied over.
+**
+** Tags in an arena are interned. Each is made
+** once for a given name and the tag it's added
+** to, after which those two pointers find it in
+** `paths`, so every node of a rule shares one
+** tag string and adding a name to it is just a
+** probe. Being shared they mustn't be written.
+*/
+
+enum {
+  MPC_AST_ARENA_MIN = 16384,
+  MPC_AST_ARENA_ALIGN = 8,
+  MPC_AST_PATHS_MIN = 64
+};
+
+enum {
+  MPC_AST_PATH_SET,
+  MPC_AST_PATH_ADD,
+  MPC_AST_PATH_ROOT
+};
+
+typedef struct {
+  const char *t;
+  const char *under;
+  char *tag;
+  size_t tl;
+  int kind;
+} mpc_ast_path_t;
+
+typedef struct mpc_ast_block_t {
+  struct mpc_ast_block_t *next;
+  size_t used;
+  size_t size;
+} mpc_ast_block_t;
+
+struct mpc_ast_arena_t {
+  mpc_ast_block_t *blocks;
+  mpc_ast_t *root;
+  int foreign;
+  mpc_ast_path_t *paths;
+  int paths_num;
+  int paths_slots;
+};
+
+static mpc_ast_arena_t *mpc_ast_arena_new(void) {
+  mpc_ast_arena_t *m = malloc(sizeof(mpc_ast_arena_t));
+  m->blocks = NULL;
+  m->root = NULL;
+  m->foreign = 0;
+  m->paths = NULL;
+  m->paths_num = 0;
+  m->paths_slots = 0;
+  return m;
+}
+
+static void mpc_ast_arena_delete(mpc_ast_arena_t *m) {
+  mpc_ast_block_t *b;
+  while (m->blocks) {
+    b = m->blocks->next;
+    free(m->blocks);
+    m->blocks = b;
+  }
+  free(m->paths);
+  free(m);
+}
+
+static void *mpc_ast_arena_alloc(mpc_ast_arena_t *m, size_t n) {
+  
+  mpc_ast_block_t *b = m->blocks;
+  size_t size;
+  
+  n = (n + MPC_AST_ARENA_ALIGN - 1) & ~(size_t)(MPC_AST_ARENA_ALIGN - 1);
+  
+  if (b == NULL || b->used + n > b->size) {
+    size = b ? b->size * 2 : MPC_AST_ARENA_MIN;
+    while (size < n) { size = size * 2; }
+    b = malloc(sizeof(mpc_ast_block_t) + size);
+    b->next = m->blocks;
+    b->used = 0;
+    b->size = size;
+    m->blocks = b;
+  }
+  
+  b->used += n;
+  return (char*)(b + 1) + (b->used - n);
+}
+
+static int mpc_ast_arena_has(mpc_ast_arena_t *m, void *p) {
+  mpc_ast_block_t *b;
+  for (b = m->blocks; b; b = b->next) {
+    if ((char*)p >= (char*)(b + 1) && (char*)p < (char*)(b + 1) + b->used) { return 1; }
+  }
+  return 0;
+}
+
+/*
+** At the end of a parse the arena goes to the
+** result if it is one of its nodes, otherwise
+** everything in it is dead.
+*/
+
+static void mpc_ast_arena_finish(mpc_ast_arena_t *m, mpc_val_t *x) {
+  if (x && mpc_ast_arena_has(m, x) && ((mpc_ast_t*)x)->arena == m) {
+    m->root = x;
+  } else {
+    mpc_ast_arena_delete(m);
+  }
+}
+
+static void *mpc_ast_alloc(mpc_ast_arena_t *m, size_t n) {
+  return m ? mpc_ast_arena_alloc(m, n) : malloc(n);
+}
+
+static size_t mpc_ast_path_hash(const char *t, const char *under, int kind) {
+  return ((size_t)t >> 3) ^ ((size_t)under * 2654435761u) ^ (size_t)kind;
+}
+
+/*
+** The name is found by pointer, but as it may
+** not outlive the tree its characters are also
+** checked against the copy at the front of the
+** tag, which takes no `strlen` as `tl` is known.
+*/
+
+static int mpc_ast_path_eq(mpc_ast_path_t *e, const char *t, const char *under, int kind) {
+  if (e->t != t || e->under != under || e->kind != kind) { return 0; }
+  if (strncmp(e->tag, t, e->tl) != 0) { return 0; }
+  switch (kind) {
+    case MPC_AST_PATH_SET: return t[e->tl] == '\0';
+    case MPC_AST_PATH_ADD: return t[e->tl] == '\0';
+    case MPC_AST_PATH_ROOT: return t[e->tl] != '\0' && t[e->tl+1] == '\0';
+  }
+  return 0;
+}
+
+static void mpc_ast_path_grow(mpc_ast_arena_t *m) {
+  
+  mpc_ast_path_t *paths = m->paths;
+  int j, slots = m->paths_slots;
+  size_t h;
+  
+  m->paths_slots = slots ? slots * 2 : MPC_AST_PATHS_MIN;
+  m->paths = calloc(m->paths_slots, sizeof(mpc_ast_path_t));
+  
+  for (j = 0; j < slots; j++) {
+    if (paths[j].tag == NULL) { continue; }
+    h = mpc_ast_path_hash(paths[j].t, paths[j].under, paths[j].kind);
+    while (m->paths[h % m->paths_slots].tag) { h++; }
+    m->paths[h % m->paths_slots] = paths[j];
+  }
+  
+  free(paths);
+}
+
+/*
+** Finds the interned tag for `t` put on `under`:
+** just `t` for SET, `t|under` for ADD, and for ROOT
+** `t` less its last character (the `>` of a root
+** tag) in front of `under`.
+*/
+
+static char *mpc_ast_path(mpc_ast_arena_t *m, const char *t, const char *under, int kind) {
+  
+  mpc_ast_path_t *e;
+  size_t h, tl, ul;
+  
+  if (m->paths_slots) {
+    h = mpc_ast_path_hash(t, under, kind);
+    while (m->paths[h % m->paths_slots].tag) {
+      e = &m->paths[h % m->paths_slots];
+      if (mpc_ast_path_eq(e, t, under, kind)) { return e->tag; }
+      h++;
+    }
+  }
+  
+  if ((m->paths_num + 1) * 2 > m->paths_slots) { mpc_ast_path_grow(m); }
+  
+  h = mpc_ast_path_hash(t, under, kind);
+  while (m->paths[h % m->paths_slots].tag) { h++; }
+  e = &m->paths[h % m->paths_slots];
+  
+  tl = strlen(t) - (kind == MPC_AST_PATH_ROOT ? 1 : 0);
+  ul = under ? strlen(under) : 0;
+  
+  e->t = t;
+  e->under = under;
+  e->kind = kind;
+  e->tl = tl;
+  e->tag = mpc_ast_arena_alloc(m, tl + 1 + ul + 1);
+  memcpy(e->tag, t, tl);
+  if (kind == MPC_AST_PATH_ADD) { e->tag[tl++] = '|'; }
+  if (under) { memcpy(e->tag + tl, under, ul); }
+  e->tag[tl + ul] = '\0';
+  m->paths_num++;
+  
+  return e->tag;
+}
+
+static mpc_ast_t *mpc_ast_new_in(mpc_ast_arena_t *m, const char *tag, const char *contents) {
+  
+  size_t cl = strlen(contents) + 1;
+  mpc_ast_t *a;
+  
+  if (m) {
+    a = mpc_ast_arena_alloc(m, sizeof(mpc_ast_t) + cl);
+    a->tag = mpc_ast_path(m, tag, NULL, MPC_AST_PATH_SET);
+    a->contents = (char*)(a + 1);
+  } else {
+    a = malloc(sizeof(mpc_ast_t));
+    a->tag = malloc(strlen(tag) + 1);
+    a->contents = malloc(cl);
+    strcpy(a->tag, tag);
+  }
+  
+  memcpy(a->contents, contents, cl);
+  a->state = mpc_state_new();
+  a->children_num = 0;
+  a->children = NULL;
+  a->rule = 0;
+  a->tags = 0;
+  a->arena = m;
+  return a;
+}
+
+static void mpc_ast_delete_foreign(mpc_ast_t *a) {
+  int i;
+  for (i = 0; i < a->children_num; i++) {
+    if (a->children[i]->arena) {
+      mpc_ast_delete_foreign(a->children[i]);
+    } else {
+      mpc_ast_delete(a->children[i]);
+    }
+  }
+}
+
+void mpc_ast_delete(mpc_ast_t *a) {
+  
+  int i;
+  
+  if (a == NULL) { return; }
+  
+  if (a->arena) {
+    if (a->arena->foreign) { mpc_ast_delete_foreign(a); }
+    if (a->arena->root == a) { mpc_ast_arena_delete(a->arena); }
+    return;
+  }
+  
+  for (i = 0; i < a->children_num; i++) {
+    mpc_ast_delete(a->children[i]);
   }
   
   free(a->children);
@@ -2803,6 +5311,7 @@ void mpc_ast_delete(mpc_ast_t *a) {
 }
 
 static void mpc_ast_delete_no_children(mpc_ast_t *a) {
+  if (a->arena) { return; }
   free(a->children);
   free(a->tag);
   free(a->contents);
@@ -2810,21 +5319,43 @@ static void mpc_ast_delete_no_children(mpc_ast_t *a) {
 }
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
+  return mpc_ast_new_in(NULL, tag, contents);
+}
+
+static mpc_ast_t *mpc_ast_copy_in(mpc_ast_arena_t *m, mpc_ast_t *a) {
   
-  mpc_ast_t *a = malloc(sizeof(mpc_ast_t));
-  
-  a->tag = malloc(strlen(tag) + 1);
-  strcpy(a->tag, tag);
-  
-  a->contents = malloc(strlen(contents) + 1);
-  strcpy(a->contents, contents);
-  
-  a->state = mpc_state_new();
+  int i;
+  mpc_ast_t *b;
   
-  a->children_num = 0;
-  a->children = NULL;
-  return a;
+  if (a == NULL) { return a; }
   
+  b = mpc_ast_new_in(m, a->tag, a->contents);
+  b->state = a->state;
+  b->rule = a->rule;
+  b->tags = a->tags;
+  b->children_num = a->children_num;
+  b->children = a->children_num ? mpc_ast_alloc(m, sizeof(mpc_ast_t*) * a->children_num) : NULL;
+  for (i = 0; i < a->children_num; i++) {
+    b->children[i] = mpc_ast_copy_in(m, a->children[i]);
+  }
+  return b;
+}
+
+/*
+** Makes `a` fit to go under `r`, copying it 
+** over if it lives in some other arena.
+*/
+
+static mpc_ast_t *mpc_ast_adopt(mpc_ast_t *r, mpc_ast_t *a) {
+  mpc_ast_t *b;
+  if (a->arena == r->arena) {
+    if (a->arena && a->arena->root == a) { a->arena->root = r; }
+    return a;
+  }
+  if (a->arena == NULL) { r->arena->foreign++; return a; }
+  b = mpc_ast_copy_in(r->arena, a);
+  mpc_ast_delete(a);
+  return b;
 }
 
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
@@ -2853,7 +5384,7 @@ mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a) {
   if (a->children_num == 0) { return a; }
   if (a->children_num == 1) { return a; }
 
-  r = mpc_ast_new(">", "");
+  r = mpc_ast_new_in(a->arena, ">", "");
   mpc_ast_add_child(r, a);
   return r;
 }
@@ -2874,32 +5405,77 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
 }
 
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
-  r->children_num++;
-  r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
-  r->children[r->children_num-1] = a;
+  
+  mpc_ast_t **children;
+  
+  a = mpc_ast_adopt(r, a);
+  
+  if (r->arena) {
+    children = mpc_ast_arena_alloc(r->arena, sizeof(mpc_ast_t*) * (r->children_num + 1));
+    if (r->children_num) { memcpy(children, r->children, sizeof(mpc_ast_t*) * r->children_num); }
+    r->children = children;
+  } else {
+    r->children = realloc(r->children, sizeof(mpc_ast_t*) * (r->children_num + 1));
+  }
+  
+  r->children[r->children_num++] = a;
   return r;
 }
 
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
+  size_t tl, al;
   if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
-  memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, strlen(t));
-  memmove(a->tag + strlen(t), "|", 1);
+  if (a->arena) {
+    a->tag = mpc_ast_path(a->arena, t, a->tag, MPC_AST_PATH_ADD);
+    return a;
+  }
+  tl = strlen(t);
+  al = strlen(a->tag);
+  a->tag = realloc(a->tag, tl + 1 + al + 1);
+  memmove(a->tag + tl + 1, a->tag, al + 1);
+  memmove(a->tag, t, tl);
+  memmove(a->tag + tl, "|", 1);
   return a;
 }
 
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
+  size_t tl, al;
   if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
-  memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, (strlen(t)-1));
+  if (a->arena) {
+    a->tag = mpc_ast_path(a->arena, t, a->tag, MPC_AST_PATH_ROOT);
+    return a;
+  }
+  tl = strlen(t) - 1;
+  al = strlen(a->tag);
+  a->tag = realloc(a->tag, tl + al + 1);
+  memmove(a->tag + tl, a->tag, al + 1);
+  memmove(a->tag, t, tl);
   return a;
 }
 
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
-  a->tag = realloc(a->tag, strlen(t) + 1);
-  strcpy(a->tag, t);
+  if (a->arena) {
+    a->tag = mpc_ast_path(a->arena, t, NULL, MPC_AST_PATH_SET);
+  } else {
+    a->tag = realloc(a->tag, strlen(t) + 1);
+    strcpy(a->tag, t);
+  }
+  a->rule = 0;
+  a->tags = 0;
+  return a;
+}
+
+static mpc_ast_t *mpc_ast_add_rule(mpc_ast_t *a, mpc_parser_t *p) {
+  if (a == NULL) { return a; }
+  mpc_ast_add_tag(a, p->name);
+  if (a->rule == 0) { a->rule = p->id; }
+  if (p->id < (int)(sizeof(unsigned long) * 8)) { a->tags |= 1ul << p->id; }
+  return a;
+}
+
+static mpc_ast_t *mpc_ast_add_root_rule(mpc_ast_t *a, mpc_ast_t *r) {
+  if (a->rule == 0) { a->rule = r->rule; }
+  a->tags |= r->tags;
   return a;
 }
 
@@ -2909,6 +5485,35 @@ mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
   return a;
 }
 
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a) {
+  return mpc_ast_copy_in(NULL, a);
+}
+
+/*
+** A node of its own in the same arena over the
+** same children, which nothing changes in place,
+** so tags can be put on it without touching `a`.
+*/
+
+static mpc_ast_t *mpc_ast_shallow(mpc_ast_t *a) {
+  mpc_ast_t *b = mpc_ast_arena_alloc(a->arena, sizeof(mpc_ast_t));
+  *b = *a;
+  return b;
+}
+
+/*
+** How memoized trees are handed out again. Trees
+** in an arena share everything below the root,
+** but one holding heap nodes is copied as those
+** would be freed once for every tree they're in.
+*/
+
+static mpc_ast_t *mpc_ast_share(mpc_ast_t *a) {
+  if (a == NULL) { return a; }
+  if (a->arena == NULL || a->arena->foreign) { return mpc_ast_copy(a); }
+  return mpc_ast_shallow(a);
+}
+
 static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
   
   int i;
@@ -3113,29 +5718,45 @@ void mpc_ast_traverse_free(mpc_ast_trav_t **trav) {
 
 mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
   
-  int i, j;
+  int i, j, k;
   mpc_ast_t** as = (mpc_ast_t**)xs;
-  mpc_ast_t *r;
+  mpc_ast_t *r, *c;
+  mpc_ast_arena_t *m = NULL;
   
   if (n == 0) { return NULL; }
   if (n == 1) { return xs[0]; }
   if (n == 2 && xs[1] == NULL) { return xs[0]; }
   if (n == 2 && xs[0] == NULL) { return xs[1]; }
   
-  r = mpc_ast_new(">", "");
+  for (i = 0; i < n && m == NULL; i++) {
+    if (as[i]) { m = as[i]->arena; }
+  }
+  
+  r = mpc_ast_new_in(m, ">", "");
+  
+  /* Size the children exactly first */
+  for (i = 0, k = 0; i < n; i++) {
+    if (as[i] == NULL) { continue; }
+    as[i] = mpc_ast_adopt(r, as[i]);
+    k += as[i]->children_num >= 2 ? as[i]->children_num : 1;
+  }
+  
+  r->children = k ? mpc_ast_alloc(m, sizeof(mpc_ast_t*) * k) : NULL;
   
   for (i = 0; i < n; i++) {
     
     if (as[i] == NULL) { continue; }
     
-    if        (as[i] && as[i]->children_num == 0) {
-      mpc_ast_add_child(r, as[i]);
-    } else if (as[i] && as[i]->children_num == 1) {
-      mpc_ast_add_child(r, mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
+    if        (as[i]->children_num == 0) {
+      r->children[r->children_num++] = as[i];
+    } else if (as[i]->children_num == 1) {
+      /* The child may be shared with a memoized tree, so it is retagged as a node of its own */
+      c = as[i]->children[0]->arena ? mpc_ast_shallow(as[i]->children[0]) : as[i]->children[0];
+      r->children[r->children_num++] = mpc_ast_add_root_rule(mpc_ast_add_root_tag(c, as[i]->tag), as[i]);
       mpc_ast_delete_no_children(as[i]);
-    } else if (as[i] && as[i]->children_num >= 2) {
+    } else if (as[i]->children_num >= 2) {
       for (j = 0; j < as[i]->children_num; j++) {
-        mpc_ast_add_child(r, as[i]->children[j]);
+        r->children[r->children_num++] = as[i]->children[j];
       }
       mpc_ast_delete_no_children(as[i]);
     }
@@ -3176,6 +5797,10 @@ mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t) {
   return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_tag, (void*)t);
 }
 
+static mpc_parser_t *mpca_add_rule(mpc_parser_t *a) {
+  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_rule, a);
+}
+
 mpc_parser_t *mpca_root(mpc_parser_t *a) {
   return mpc_apply(a, (mpc_apply_t)mpc_ast_add_root);
 }
@@ -3234,6 +5859,175 @@ mpc_parser_t *mpca_and(int n, ...) {
 
 mpc_parser_t *mpca_total(mpc_parser_t *a) { return mpc_total(a, (mpc_dtor_t)mpc_ast_delete); }
 
+/*
+** Grammar Actions
+*/
+
+/*
+** Grammars built by `mpca_lang_actions` don't
+** build an AST. Every parser returns a list of
+** the values made by rule actions so far and
+** the text matched by literals. A rule with an
+** action turns its list into a single value,
+** which is put in a list of its own wherever
+** the rule is referenced. Rules without an
+** action hand their list on unchanged.
+*/
+
+typedef struct {
+  int num;
+  mpc_val_t **vals;
+  char *text;
+  mpc_dtor_t dtor;
+} mpca_vals_t;
+
+static void mpca_vals_delete(mpc_val_t *x) {
+  
+  int i;
+  mpca_vals_t *l = x;
+  
+  if (l == NULL) { return; }
+  
+  for (i = 0; i < l->num; i++) {
+    if (l->vals[i] != NULL) { l->dtor(l->vals[i]); }
+  }
+  
+  free(l->vals);
+  free(l->text);
+  free(l);
+}
+
+static mpc_val_t *mpcaf_vals_text(mpc_val_t *c) {
+  mpca_vals_t *l = malloc(sizeof(mpca_vals_t));
+  l->num = 0;
+  l->vals = NULL;
+  l->text = c;
+  l->dtor = NULL;
+  return l;
+}
+
+static mpc_val_t *mpcaf_vals_pass(mpc_val_t *x) {
+  return x;
+}
+
+static mpc_val_t *mpcaf_vals_fold(int n, mpc_val_t **xs) {
+  
+  int i, found = 0, num = 0, text = 0;
+  size_t len = 0;
+  mpca_vals_t **ls = (mpca_vals_t**)xs;
+  mpca_vals_t *l = NULL, *r;
+  
+  for (i = 0; i < n; i++) {
+    if (ls[i] == NULL) { continue; }
+    found++;
+    l = ls[i];
+    num += ls[i]->num;
+    if (ls[i]->text) { text = 1; len += strlen(ls[i]->text); }
+  }
+  
+  if (found <= 1) { return l; }
+  
+  r = malloc(sizeof(mpca_vals_t));
+  r->num = 0;
+  r->vals = num ? malloc(sizeof(mpc_val_t*) * num) : NULL;
+  r->text = text ? calloc(1, len + 1) : NULL;
+  r->dtor = NULL;
+  
+  for (i = 0; i < n; i++) {
+    if (ls[i] == NULL) { continue; }
+    if (ls[i]->num) {
+      memcpy(r->vals + r->num, ls[i]->vals, sizeof(mpc_val_t*) * ls[i]->num);
+      r->num += ls[i]->num;
+      r->dtor = ls[i]->dtor;
+    }
+    if (ls[i]->text) { strcat(r->text, ls[i]->text); }
+    free(ls[i]->vals);
+    free(ls[i]->text);
+    free(ls[i]);
+  }
+  
+  return r;
+}
+
+static mpc_val_t *mpcaf_vals_value(mpc_val_t *x, void *d) {
+  mpc_parser_t *p = d;
+  mpca_vals_t *l = malloc(sizeof(mpca_vals_t));
+  l->num = 1;
+  l->vals = malloc(sizeof(mpc_val_t*));
+  l->vals[0] = x;
+  l->text = NULL;
+  l->dtor = p->dtor;
+  return l;
+}
+
+static mpc_val_t *mpcaf_vals_action(mpc_val_t *x, void *d) {
+  
+  mpc_parser_t *p = d;
+  mpca_vals_t *l = x;
+  mpc_val_t *r;
+  
+  if (l == NULL) { return p->action("", 0, NULL); }
+  
+  r = p->action(l->text ? l->text : "", l->num, l->vals);
+  free(l->vals);
+  free(l->text);
+  free(l);
+  return r;
+}
+
+/*
+** The grammar folds for sequences and repeats
+** don't know which kind of grammar they are
+** building, so they always build the AST
+** versions. This switches them over to lists.
+*/
+
+static void mpca_vals_unretained(mpc_parser_t *p, int force) {
+  
+  int i;
+  
+  if (p->retained && !force) { return; }
+  
+  switch (p->type) {
+    case MPC_TYPE_EXPECT:     mpca_vals_unretained(p->data.expect.x, 0);     break;
+    case MPC_TYPE_APPLY:      mpca_vals_unretained(p->data.apply.x, 0);      break;
+    case MPC_TYPE_APPLY_TO:   mpca_vals_unretained(p->data.apply_to.x, 0);   break;
+    case MPC_TYPE_CHECK:      mpca_vals_unretained(p->data.check.x, 0);      break;
+    case MPC_TYPE_CHECK_WITH: mpca_vals_unretained(p->data.check_with.x, 0); break;
+    case MPC_TYPE_PREDICT:    mpca_vals_unretained(p->data.predict.x, 0);    break;
+    case MPC_TYPE_SPAN:       mpca_vals_unretained(p->data.span.x, 0);       break;
+    
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      mpca_vals_unretained(p->data.not.x, 0);
+      if (p->data.not.dx == (mpc_dtor_t)mpc_ast_delete) { p->data.not.dx = mpca_vals_delete; }
+    break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpca_vals_unretained(p->data.repeat.x, 0);
+      if (p->data.repeat.f == mpcf_fold_ast) { p->data.repeat.f = mpcaf_vals_fold; }
+      if (p->data.repeat.dx == (mpc_dtor_t)mpc_ast_delete) { p->data.repeat.dx = mpca_vals_delete; }
+    break;
+    
+    case MPC_TYPE_OR:
+      for (i = 0; i < p->data.or.n; i++) { mpca_vals_unretained(p->data.or.xs[i], 0); }
+    break;
+    
+    case MPC_TYPE_AND:
+      for (i = 0; i < p->data.and.n; i++) { mpca_vals_unretained(p->data.and.xs[i], 0); }
+      if (p->data.and.f == mpcf_fold_ast) {
+        p->data.and.f = mpcaf_vals_fold;
+        for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = mpca_vals_delete; }
+      }
+    break;
+    
+    default: break;
+  }
+  
+}
+
 /*
 ** Grammar Parser
 */
@@ -3283,6 +6077,8 @@ typedef struct {
   int parsers_num;
   mpc_parser_t **parsers;
   int flags;
+  const mpca_action_def_t *actions;
+  mpc_dtor_t dtor;
 } mpca_grammar_st_t;
 
 static mpc_val_t *mpcaf_grammar_or(int n, mpc_val_t **xs) {
@@ -3322,6 +6118,7 @@ static mpc_val_t *mpcaf_grammar_string(mpc_val_t *x, void *s) {
   char *y = mpcf_unescape(x);
   mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_string(y) : mpc_tok(mpc_string(y));
   free(y);
+  if (st->actions) { return mpc_apply(p, mpcaf_vals_text); }
   return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "string"));
 }
 
@@ -3330,14 +6127,17 @@ static mpc_val_t *mpcaf_grammar_char(mpc_val_t *x, void *s) {
   char *y = mpcf_unescape(x);
   mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_char(y[0]) : mpc_tok(mpc_char(y[0]));
   free(y);
+  if (st->actions) { return mpc_apply(p, mpcaf_vals_text); }
   return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "char"));
 }
 
 static mpc_val_t *mpcaf_grammar_regex(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape_regex(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_re(y) : mpc_tok(mpc_re(y));
+  mpc_parser_t *p = (st->flags & MPCA_LANG_PREDICTIVE) ? mpc_re_predictive(y) : mpc_re(y);
+  p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? p : mpc_tok(p);
   free(y);
+  if (st->actions) { return mpc_apply(p, mpcaf_vals_text); }
   return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "regex"));
 }
 
@@ -3348,6 +6148,26 @@ static int is_number(const char* s) {
   return 1;
 }
 
+static void mpca_grammar_set_id(mpc_parser_t *p, int id, mpca_grammar_st_t *st) {
+  
+  const mpca_action_def_t *a;
+  
+  p->id = id;
+  p->action = NULL;
+  p->dtor = st->dtor;
+  
+  for (a = st->actions; a && a->name; a++) {
+    if (p->name && strcmp(p->name, a->name) == 0) { p->action = a->action; }
+  }
+  
+  /* Action values can't be copied, so those rules only remember failures */
+  if (st->flags & MPCA_LANG_MEMOIZE) {
+    if (st->actions) { mpc_memoize(p, NULL, NULL); }
+    else { mpc_memoize(p, (mpc_copy_t)mpc_ast_share, (mpc_dtor_t)mpc_ast_delete); }
+  }
+  
+}
+
 static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
   
   int i;
@@ -3365,6 +6185,7 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
       if (st->parsers[st->parsers_num-1] == NULL) {
         return mpc_failf("No Parser in position %i! Only supplied %i Parsers!", i, st->parsers_num);
       }
+      mpca_grammar_set_id(st->parsers[st->parsers_num-1], st->parsers_num, st);
     }
     
     return st->parsers[st->parsers_num-1];
@@ -3389,6 +6210,7 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
       st->parsers[st->parsers_num-1] = p;
       
       if (p == NULL || p->name == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
+      mpca_grammar_set_id(p, st->parsers_num, st);
       if (p->name && strcmp(p->name, x) == 0) { return p; }
       
     }
@@ -3403,8 +6225,12 @@ static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
   mpc_parser_t *p = mpca_grammar_find_parser(x, st);
   free(x);
 
+  if (st->actions) {
+    return p->action ? mpc_apply_to(p, mpcaf_vals_value, p) : mpc_apply(p, mpcaf_vals_pass);
+  }
+
   if (p->name) {
-    return mpca_state(mpca_root(mpca_add_tag(p, p->name)));
+    return mpca_state(mpca_root(mpca_add_rule(p)));
   } else {
     return mpca_state(mpca_root(p));
   }
@@ -3487,6 +6313,8 @@ mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.actions = NULL;
+  st.dtor = NULL;
   
   res = mpca_grammar_st(grammar, &st);  
   free(st.parsers);
@@ -3541,6 +6369,8 @@ static void mpca_stmt_list_delete(mpc_val_t *x) {
 
 }
 
+static void mpc_optimise_dispatch(mpc_parser_t *p, int force);
+
 static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
 
   mpca_grammar_st_t *st = s;
@@ -3551,10 +6381,23 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
   while(*stmts) {
     stmt = *stmts;
     left = mpca_grammar_find_parser(stmt->ident, st);
+    if (st->actions) {
+      mpca_vals_unretained(stmt->grammar, 0);
+      if (left->action) { stmt->grammar = mpc_apply_to(stmt->grammar, mpcaf_vals_action, left); }
+    }
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
     mpc_optimise(stmt->grammar);
     mpc_define(left, stmt->grammar);
+    stmt->grammar = left;
+    stmts++;
+  }
+  
+  /* Now every rule is defined the dispatch tables can see all of them */
+  stmts = x;
+  while(*stmts) {
+    stmt = *stmts;
+    mpc_optimise_dispatch(stmt->grammar, 1);
     free(stmt->ident);
     free(stmt->name);
     free(stmt);
@@ -3647,6 +6490,8 @@ mpc_err_t *mpca_lang_file(int flags, FILE *f, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.actions = NULL;
+  st.dtor = NULL;
   
   i = mpc_input_new_file("<mpca_lang_file>", f);
   err = mpca_lang_st(i, &st);
@@ -3669,6 +6514,8 @@ mpc_err_t *mpca_lang_pipe(int flags, FILE *p, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.actions = NULL;
+  st.dtor = NULL;
   
   i = mpc_input_new_pipe("<mpca_lang_pipe>", p);
   err = mpca_lang_st(i, &st);
@@ -3679,19 +6526,21 @@ mpc_err_t *mpca_lang_pipe(int flags, FILE *p, ...) {
   return err;
 }
 
-mpc_err_t *mpca_lang(int flags, const char *language, ...) {
+mpc_err_t *mpca_lang_actions(int flags, const char *language, const mpca_action_def_t *actions, mpc_dtor_t dtor, ...) {
   
   mpca_grammar_st_t st;
   mpc_input_t *i;
   mpc_err_t *err;
   
   va_list va;  
-  va_start(va, language);
+  va_start(va, dtor);
   
   st.va = &va;
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.actions = actions;
+  st.dtor = dtor;
   
   i = mpc_input_new_string("<mpca_lang>", language);
   err = mpca_lang_st(i, &st);
@@ -3702,17 +6551,42 @@ mpc_err_t *mpca_lang(int flags, const char *language, ...) {
   return err;
 }
 
-mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
+mpc_err_t *mpca_lang(int flags, const char *language, ...) {
   
   mpca_grammar_st_t st;
   mpc_input_t *i;
   mpc_err_t *err;
   
-  va_list va;
-
-  FILE *f = fopen(filename, "rb");
+  va_list va;  
+  va_start(va, language);
   
-  if (f == NULL) {
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+  st.actions = NULL;
+  st.dtor = NULL;
+  
+  i = mpc_input_new_string("<mpca_lang>", language);
+  err = mpca_lang_st(i, &st);
+  mpc_input_delete(i);
+  
+  free(st.parsers);
+  va_end(va);
+  return err;
+}
+
+mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
+  
+  mpca_grammar_st_t st;
+  mpc_input_t *i;
+  mpc_err_t *err;
+  
+  va_list va;
+
+  FILE *f = fopen(filename, "rb");
+  
+  if (f == NULL) {
     err = mpc_err_file(filename, "Unable to open file!");
     return err;
   }
@@ -3723,6 +6597,8 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   st.parsers_num = 0;
   st.parsers = NULL;
   st.flags = flags;
+  st.actions = NULL;
+  st.dtor = NULL;
   
   i = mpc_input_new_file(filename, f);
   err = mpca_lang_st(i, &st);
@@ -3736,6 +6612,715 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   return err;
 }
 
+/*
+** Grammar Images
+**
+** An image is the parsers `mpca_lang` built,
+** written out so they can be put back without
+** parsing the grammar again. Each rule's tree
+** is written in turn. A use of a rule is its
+** position, a library function its position
+** in `mpca_image_fns`, and the pointers mpca
+** leaves in `apply_to` data are written as what
+** they point at. Numbers are four bytes little
+** endian so an image reads the same from a file
+** or compiled into the program as an array.
+*/
+
+enum {
+  MPCA_IMAGE_VERSION = 3,
+  MPCA_IMAGE_NULL = 0,
+  MPCA_IMAGE_RULE = 1,
+  MPCA_IMAGE_TAG  = 2
+};
+
+typedef void(*mpca_image_fn_t)(void);
+
+typedef struct {
+  mpca_image_fn_t f;
+  const char *name;
+} mpca_image_fn_def_t;
+
+#define MPCA_IMAGE_FN(f) { (mpca_image_fn_t)(f), #f }
+
+static const mpca_image_fn_def_t mpca_image_fns[] = {
+  { NULL, "NULL" },
+  MPCA_IMAGE_FN(free),
+  MPCA_IMAGE_FN(mpcf_dtor_null),
+  MPCA_IMAGE_FN(mpcf_ctor_null),
+  MPCA_IMAGE_FN(mpcf_ctor_str),
+  MPCA_IMAGE_FN(mpcf_free),
+  MPCA_IMAGE_FN(mpcf_int),
+  MPCA_IMAGE_FN(mpcf_hex),
+  MPCA_IMAGE_FN(mpcf_oct),
+  MPCA_IMAGE_FN(mpcf_float),
+  MPCA_IMAGE_FN(mpcf_strtriml),
+  MPCA_IMAGE_FN(mpcf_strtrimr),
+  MPCA_IMAGE_FN(mpcf_strtrim),
+  MPCA_IMAGE_FN(mpcf_escape),
+  MPCA_IMAGE_FN(mpcf_escape_regex),
+  MPCA_IMAGE_FN(mpcf_escape_string_raw),
+  MPCA_IMAGE_FN(mpcf_escape_char_raw),
+  MPCA_IMAGE_FN(mpcf_unescape),
+  MPCA_IMAGE_FN(mpcf_unescape_regex),
+  MPCA_IMAGE_FN(mpcf_unescape_string_raw),
+  MPCA_IMAGE_FN(mpcf_unescape_char_raw),
+  MPCA_IMAGE_FN(mpcf_null),
+  MPCA_IMAGE_FN(mpcf_fst),
+  MPCA_IMAGE_FN(mpcf_snd),
+  MPCA_IMAGE_FN(mpcf_trd),
+  MPCA_IMAGE_FN(mpcf_fst_free),
+  MPCA_IMAGE_FN(mpcf_snd_free),
+  MPCA_IMAGE_FN(mpcf_trd_free),
+  MPCA_IMAGE_FN(mpcf_strfold),
+  MPCA_IMAGE_FN(mpcf_maths),
+  MPCA_IMAGE_FN(mpcf_fold_ast),
+  MPCA_IMAGE_FN(mpcf_str_ast),
+  MPCA_IMAGE_FN(mpcf_state_ast),
+  MPCA_IMAGE_FN(mpc_soi_anchor),
+  MPCA_IMAGE_FN(mpc_eoi_anchor),
+  MPCA_IMAGE_FN(mpc_boundary_anchor),
+  MPCA_IMAGE_FN(mpc_soft_delete),
+  MPCA_IMAGE_FN(mpc_ast_delete),
+  MPCA_IMAGE_FN(mpc_ast_copy),
+  MPCA_IMAGE_FN(mpc_ast_share),
+  MPCA_IMAGE_FN(mpc_ast_tag),
+  MPCA_IMAGE_FN(mpc_ast_add_tag),
+  MPCA_IMAGE_FN(mpc_ast_add_rule),
+  MPCA_IMAGE_FN(mpc_ast_add_root),
+  MPCA_IMAGE_FN(mpca_vals_delete),
+  MPCA_IMAGE_FN(mpcaf_vals_text),
+  MPCA_IMAGE_FN(mpcaf_vals_pass),
+  MPCA_IMAGE_FN(mpcaf_vals_fold),
+  MPCA_IMAGE_FN(mpcaf_vals_value),
+  MPCA_IMAGE_FN(mpcaf_vals_action)
+};
+
+#define MPCA_IMAGE_FNS_NUM ((int)(sizeof(mpca_image_fns) / sizeof(mpca_image_fn_def_t)))
+
+/* The tags mpca gives to literals */
+static const char *mpca_image_tags[] = { "string", "char", "regex" };
+
+static int mpca_image_fn(mpca_image_fn_t f) {
+  int j;
+  for (j = 0; j < MPCA_IMAGE_FNS_NUM; j++) {
+    if (mpca_image_fns[j].f == f) { return j; }
+  }
+  return -1;
+}
+
+/*
+** An image only means something to a build with
+** the same function and tag tables and the same
+** parser types, so it starts with their sizes, a
+** hash of the names in them, and the sizes of the
+** parser structs, and is refused if any differ.
+*/
+
+enum { MPCA_IMAGE_STAMP_NUM = 6 };
+
+static unsigned long mpca_image_hash_bytes(unsigned long h, const unsigned char *s, size_t n) {
+  size_t j;
+  for (j = 0; j < n; j++) { h = ((h ^ s[j]) * 16777619ul) & 0xFFFFFFFFul; }
+  return h;
+}
+
+static unsigned long mpca_image_hash(unsigned long h, const char *s) {
+  return mpca_image_hash_bytes(h, (const unsigned char *)s, strlen(s) + 1);
+}
+
+static void mpca_image_stamp(long *xs) {
+  int j;
+  unsigned long h = 2166136261ul;
+  for (j = 0; j < MPCA_IMAGE_FNS_NUM; j++) { h = mpca_image_hash(h, mpca_image_fns[j].name); }
+  for (j = 0; j < (int)(sizeof(mpca_image_tags) / sizeof(char*)); j++) { h = mpca_image_hash(h, mpca_image_tags[j]); }
+  xs[0] = MPCA_IMAGE_FNS_NUM;
+  xs[1] = (long)(h & 0x7FFFFFFFul);
+  xs[2] = MPC_TYPE_NUM;
+  xs[3] = (long)sizeof(mpc_pdata_t);
+  xs[4] = (long)sizeof(mpc_parser_t);
+  xs[5] = (long)sizeof(mpca_image_fn_t);
+}
+
+/*
+** Everything written is hashed as it goes, and the
+** hash ends the image, so one that was damaged
+** after it was saved is refused as corrupt rather
+** than calling functions on data they don't expect.
+*/
+
+typedef struct {
+  FILE *f;
+  int n;
+  mpc_parser_t **ps;
+  const char *err;
+  unsigned long hash;
+} mpca_image_out_t;
+
+static void mpca_image_put_bytes(mpca_image_out_t *o, const void *x, size_t n) {
+  o->hash = mpca_image_hash_bytes(o->hash, x, n);
+  fwrite(x, 1, n, o->f);
+}
+
+static void mpca_image_put_int(mpca_image_out_t *o, long x) {
+  int j;
+  unsigned char b[4];
+  for (j = 0; j < 4; j++) { b[j] = (unsigned char)(((unsigned long)x >> (8 * j)) & 0xFF); }
+  mpca_image_put_bytes(o, b, 4);
+}
+
+static void mpca_image_put_str(mpca_image_out_t *o, const char *s) {
+  if (s == NULL) { mpca_image_put_int(o, -1); return; }
+  mpca_image_put_int(o, (long)strlen(s));
+  mpca_image_put_bytes(o, s, strlen(s));
+}
+
+static void mpca_image_put_fn(mpca_image_out_t *o, mpca_image_fn_t f) {
+  int j = mpca_image_fn(f);
+  if (j < 0) { o->err = "Function is not part of mpc so can't be saved!"; }
+  mpca_image_put_int(o, j);
+}
+
+static void mpca_image_put_rule(mpca_image_out_t *o, mpc_parser_t *p) {
+  int j;
+  for (j = 0; j < o->n; j++) {
+    if (o->ps[j] == p) { mpca_image_put_int(o, j); return; }
+  }
+  o->err = "Grammar uses a parser that isn't being saved!";
+  mpca_image_put_int(o, 0);
+}
+
+static void mpca_image_put_data(mpca_image_out_t *o, mpc_apply_to_t f, void *d) {
+  
+  int j;
+  
+  if (d == NULL) { mpca_image_put_int(o, MPCA_IMAGE_NULL); return; }
+  
+  if (f == (mpc_apply_to_t)mpc_ast_add_rule || f == mpcaf_vals_value || f == mpcaf_vals_action) {
+    mpca_image_put_int(o, MPCA_IMAGE_RULE);
+    mpca_image_put_rule(o, d);
+    return;
+  }
+  
+  if (f == (mpc_apply_to_t)mpc_ast_tag || f == (mpc_apply_to_t)mpc_ast_add_tag) {
+    for (j = 0; j < (int)(sizeof(mpca_image_tags) / sizeof(char*)); j++) {
+      if (strcmp(d, mpca_image_tags[j]) != 0) { continue; }
+      mpca_image_put_int(o, MPCA_IMAGE_TAG);
+      mpca_image_put_int(o, j);
+      return;
+    }
+  }
+  
+  o->err = "Parser data can't be saved!";
+  mpca_image_put_int(o, MPCA_IMAGE_NULL);
+}
+
+static void mpca_image_put_parser(mpca_image_out_t *o, mpc_parser_t *p, int top) {
+  
+  int i;
+  
+  if (p->retained && !top) {
+    mpca_image_put_int(o, -1);
+    mpca_image_put_rule(o, p);
+    return;
+  }
+  
+  /* Rule dtors are the one given when loading */
+  i = mpca_image_fn((mpca_image_fn_t)p->dtor);
+  if (i < 0 && !p->retained) { o->err = "Function is not part of mpc so can't be saved!"; }
+  
+  mpca_image_put_int(o, p->type);
+  mpca_image_put_str(o, p->name);
+  mpca_image_put_int(o, p->id);
+  mpca_image_put_int(o, p->action != NULL);
+  mpca_image_put_int(o, i);
+  mpca_image_put_int(o, p->memo);
+  mpca_image_put_fn(o, (mpca_image_fn_t)p->memo_copy);
+  mpca_image_put_fn(o, (mpca_image_fn_t)p->memo_dtor);
+  mpca_image_put_int(o, p->depth_max);
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_FAIL: mpca_image_put_str(o, p->data.fail.m); break;
+    
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+      if (p->data.lift.x) { o->err = "Parser data can't be saved!"; }
+      mpca_image_put_fn(o, (mpca_image_fn_t)p->data.lift.lf);
+      break;
+    
+    case MPC_TYPE_EXPECT:
+      mpca_image_put_parser(o, p->data.expect.x, 0);
+      mpca_image_put_str(o, p->data.expect.m);
+      break;
+    
+    case MPC_TYPE_ANCHOR:  mpca_image_put_fn(o, (mpca_image_fn_t)p->data.anchor.f);  break;
+    case MPC_TYPE_SATISFY: mpca_image_put_fn(o, (mpca_image_fn_t)p->data.satisfy.f); break;
+    case MPC_TYPE_SINGLE:  mpca_image_put_int(o, (unsigned char)p->data.single.x);   break;
+    case MPC_TYPE_STRING:  mpca_image_put_str(o, p->data.string.x);                  break;
+    
+    case MPC_TYPE_RANGE:
+      mpca_image_put_int(o, (unsigned char)p->data.range.x);
+      mpca_image_put_int(o, (unsigned char)p->data.range.y);
+      break;
+    
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SKIP:
+      mpca_image_put_str(o, p->data.oneof.x);
+      break;
+    
+    case MPC_TYPE_APPLY:
+      mpca_image_put_parser(o, p->data.apply.x, 0);
+      mpca_image_put_fn(o, (mpca_image_fn_t)p->data.apply.f);
+      break;
+    
+    case MPC_TYPE_APPLY_TO:
+      mpca_image_put_parser(o, p->data.apply_to.x, 0);
+      mpca_image_put_fn(o, (mpca_image_fn_t)p->data.apply_to.f);
+      mpca_image_put_data(o, p->data.apply_to.f, p->data.apply_to.d);
+      break;
+    
+    case MPC_TYPE_CHECK:
+      mpca_image_put_parser(o, p->data.check.x, 0);
+      mpca_image_put_fn(o, (mpca_image_fn_t)p->data.check.f);
+      mpca_image_put_str(o, p->data.check.e);
+      break;
+    
+    case MPC_TYPE_CHECK_WITH:
+      if (p->data.check_with.d) { o->err = "Parser data can't be saved!"; }
+      mpca_image_put_parser(o, p->data.check_with.x, 0);
+      mpca_image_put_fn(o, (mpca_image_fn_t)p->data.check_with.f);
+      mpca_image_put_str(o, p->data.check_with.e);
+      break;
+    
+    case MPC_TYPE_PREDICT: mpca_image_put_parser(o, p->data.predict.x, 0); break;
+    case MPC_TYPE_SPAN:    mpca_image_put_parser(o, p->data.span.x, 0);    break;
+    
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      mpca_image_put_parser(o, p->data.not.x, 0);
+      mpca_image_put_fn(o, (mpca_image_fn_t)p->data.not.dx);
+      mpca_image_put_fn(o, (mpca_image_fn_t)p->data.not.lf);
+      break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpca_image_put_int(o, p->data.repeat.n);
+      mpca_image_put_fn(o, (mpca_image_fn_t)p->data.repeat.f);
+      mpca_image_put_parser(o, p->data.repeat.x, 0);
+      mpca_image_put_fn(o, (mpca_image_fn_t)p->data.repeat.dx);
+      break;
+    
+    case MPC_TYPE_OR:
+      mpca_image_put_int(o, p->data.or.n);
+      for (i = 0; i < p->data.or.n; i++) { mpca_image_put_parser(o, p->data.or.xs[i], 0); }
+      mpca_image_put_int(o, p->data.or.dispatch != NULL);
+      if (p->data.or.dispatch) {
+        mpca_image_put_bytes(o, p->data.or.dispatch, 257 * ((p->data.or.n + 7) / 8));
+      }
+      break;
+    
+    case MPC_TYPE_AND:
+      mpca_image_put_int(o, p->data.and.n);
+      mpca_image_put_fn(o, (mpca_image_fn_t)p->data.and.f);
+      for (i = 0; i < p->data.and.n; i++) { mpca_image_put_parser(o, p->data.and.xs[i], 0); }
+      for (i = 0; i < p->data.and.n-1; i++) { mpca_image_put_fn(o, (mpca_image_fn_t)p->data.and.dxs[i]); }
+      break;
+    
+    case MPC_TYPE_DFA:
+      mpca_image_put_int(o, p->data.dfa.n);
+      mpca_image_put_int(o, p->data.dfa.classes);
+      mpca_image_put_bytes(o, p->data.dfa.map, 256);
+      for (i = 0; i < p->data.dfa.n * p->data.dfa.classes; i++) { mpca_image_put_int(o, p->data.dfa.next[i]); }
+      mpca_image_put_bytes(o, p->data.dfa.accept, p->data.dfa.n);
+      for (i = 0; i < p->data.dfa.n; i++) { mpca_image_put_str(o, p->data.dfa.expected[i]); }
+      break;
+    
+    case MPC_TYPE_TRIE:
+      mpca_image_put_int(o, p->data.trie.n);
+      for (i = 0; i < p->data.trie.n; i++) {
+        mpca_image_put_str(o, p->data.trie.xs[i]);
+        mpca_image_put_str(o, p->data.trie.ms[i]);
+      }
+      break;
+    
+    default: break;
+  }
+  
+}
+
+mpc_err_t *mpca_lang_save(FILE *f, int n, ...) {
+  
+  int j;
+  long stamp[MPCA_IMAGE_STAMP_NUM];
+  mpca_image_out_t o;
+  
+  va_list va;
+  va_start(va, n);
+  
+  o.f = f;
+  o.n = n;
+  o.ps = malloc(sizeof(mpc_parser_t*) * n);
+  o.err = NULL;
+  o.hash = 2166136261ul;
+  for (j = 0; j < n; j++) { o.ps[j] = va_arg(va, mpc_parser_t*); }
+  
+  mpca_image_put_bytes(&o, "MPCI", 4);
+  mpca_image_put_int(&o, MPCA_IMAGE_VERSION);
+  mpca_image_stamp(stamp);
+  for (j = 0; j < MPCA_IMAGE_STAMP_NUM; j++) { mpca_image_put_int(&o, stamp[j]); }
+  mpca_image_put_int(&o, n);
+  for (j = 0; j < n; j++) { mpca_image_put_parser(&o, o.ps[j], 1); }
+  mpca_image_put_int(&o, (long)(o.hash & 0x7FFFFFFFul));
+  
+  if (o.err == NULL && ferror(f)) { o.err = "Unable to write image!"; }
+  
+  free(o.ps);
+  va_end(va);
+  return o.err ? mpc_err_file("<mpca_lang_save>", o.err) : NULL;
+}
+
+/*
+** Reading stops at the first problem, after which
+** every read gives zero. Anything still to be made
+** comes out empty so what was built is whole and
+** can be undefined as usual.
+*/
+
+typedef struct {
+  const unsigned char *s;
+  size_t length;
+  size_t pos;
+  int n;
+  mpc_parser_t **ps;
+  const mpca_action_def_t *actions;
+  mpc_dtor_t dtor;
+  const char *err;
+} mpca_image_in_t;
+
+static void mpca_image_get_bytes(mpca_image_in_t *in, void *x, size_t n) {
+  if (!in->err && in->length - in->pos < n) { in->err = "Image is truncated!"; }
+  if (in->err) { memset(x, 0, n); return; }
+  memcpy(x, in->s + in->pos, n);
+  in->pos += n;
+}
+
+static long mpca_image_get_int(mpca_image_in_t *in) {
+  unsigned char b[4];
+  unsigned long u;
+  mpca_image_get_bytes(in, b, 4);
+  u = (unsigned long)b[0] | ((unsigned long)b[1] << 8) | ((unsigned long)b[2] << 16) | ((unsigned long)b[3] << 24);
+  return (u & 0x80000000ul) ? -(long)((~u & 0x7FFFFFFFul) + 1) : (long)u;
+}
+
+/* Counts can't be more than the bytes left could hold */
+static int mpca_image_get_count(mpca_image_in_t *in, size_t size) {
+  long n = mpca_image_get_int(in);
+  if (in->err) { return 0; }
+  if (n < 0 || (size_t)n > (in->length - in->pos) / size) { in->err = "Image is corrupt!"; return 0; }
+  return (int)n;
+}
+
+static char *mpca_image_get_str(mpca_image_in_t *in) {
+  char *s;
+  long n = mpca_image_get_int(in);
+  if (n == -1 || in->err) { return NULL; }
+  if (n < 0 || (size_t)n > in->length - in->pos) { in->err = "Image is corrupt!"; return NULL; }
+  s = malloc(n + 1);
+  mpca_image_get_bytes(in, s, n);
+  s[n] = '\0';
+  return s;
+}
+
+static mpca_image_fn_t mpca_image_fn_at(mpca_image_in_t *in, long j) {
+  if (j < 0 || j >= MPCA_IMAGE_FNS_NUM) {
+    if (!in->err) { in->err = "Image is corrupt!"; }
+    return NULL;
+  }
+  return mpca_image_fns[j].f;
+}
+
+static mpca_image_fn_t mpca_image_get_fn(mpca_image_in_t *in) {
+  return mpca_image_fn_at(in, mpca_image_get_int(in));
+}
+
+static mpc_parser_t *mpca_image_get_rule(mpca_image_in_t *in) {
+  long j = mpca_image_get_int(in);
+  if (j < 0 || j >= in->n) { if (!in->err) { in->err = "Image is corrupt!"; } return NULL; }
+  return in->ps[j];
+}
+
+static void *mpca_image_get_data(mpca_image_in_t *in) {
+  long j;
+  switch (mpca_image_get_int(in)) {
+    case MPCA_IMAGE_NULL: return NULL;
+    case MPCA_IMAGE_RULE: return mpca_image_get_rule(in);
+    case MPCA_IMAGE_TAG:
+      j = mpca_image_get_int(in);
+      if (j >= 0 && j < (long)(sizeof(mpca_image_tags) / sizeof(char*))) { return (void*)mpca_image_tags[j]; }
+    break;
+  }
+  if (!in->err) { in->err = "Image is corrupt!"; }
+  return NULL;
+}
+
+static void mpca_image_get_def(mpca_image_in_t *in, mpc_parser_t *p, long type);
+
+static mpc_parser_t *mpca_image_get_parser(mpca_image_in_t *in) {
+  mpc_parser_t *p;
+  long type = mpca_image_get_int(in);
+  if (type == -1) {
+    p = mpca_image_get_rule(in);
+    if (p) { return p; }
+    type = MPC_TYPE_UNDEFINED;
+  }
+  p = mpc_undefined();
+  mpca_image_get_def(in, p, type);
+  return p;
+}
+
+static void mpca_image_get_def(mpca_image_in_t *in, mpc_parser_t *p, long type) {
+  
+  int i;
+  long j;
+  char *name;
+  const mpca_action_def_t *a;
+  
+  if (type < MPC_TYPE_UNDEFINED || type > MPC_TYPE_TRIE) {
+    if (!in->err) { in->err = "Image is corrupt!"; }
+    type = MPC_TYPE_UNDEFINED;
+  }
+  
+  name = mpca_image_get_str(in);
+  if (p->retained) {
+    if (!in->err && (name == NULL || p->name == NULL || strcmp(name, p->name) != 0)) {
+      in->err = "Parsers given don't match the image!";
+    }
+    free(name);
+  } else {
+    p->name = name;
+  }
+  
+  p->id = mpca_image_get_int(in);
+  
+  p->action = NULL;
+  if (mpca_image_get_int(in)) {
+    for (a = in->actions; a && a->name; a++) {
+      if (p->name && strcmp(p->name, a->name) == 0) { p->action = a->action; }
+    }
+    if (p->action == NULL && !in->err) { in->err = "No action given for a rule in the image!"; }
+  }
+  
+  j = mpca_image_get_int(in);
+  p->dtor = j == -1 ? in->dtor : (mpc_dtor_t)mpca_image_fn_at(in, j);
+  
+  p->memo = (char)mpca_image_get_int(in);
+  p->memo_copy = (mpc_copy_t)mpca_image_get_fn(in);
+  p->memo_dtor = (mpc_dtor_t)mpca_image_get_fn(in);
+  p->depth_max = mpca_image_get_int(in);
+  
+  p->type = (char)type;
+  
+  switch (type) {
+    
+    case MPC_TYPE_FAIL: p->data.fail.m = mpca_image_get_str(in); break;
+    
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+      p->data.lift.lf = (mpc_ctor_t)mpca_image_get_fn(in);
+      p->data.lift.x = NULL;
+      break;
+    
+    case MPC_TYPE_EXPECT:
+      p->data.expect.x = mpca_image_get_parser(in);
+      p->data.expect.m = mpca_image_get_str(in);
+      break;
+    
+    case MPC_TYPE_ANCHOR:  p->data.anchor.f = (int(*)(char,char))mpca_image_get_fn(in); break;
+    case MPC_TYPE_SATISFY: p->data.satisfy.f = (int(*)(char))mpca_image_get_fn(in);     break;
+    case MPC_TYPE_SINGLE:  p->data.single.x = (char)mpca_image_get_int(in);             break;
+    case MPC_TYPE_STRING:  p->data.string.x = mpca_image_get_str(in);                   break;
+    
+    case MPC_TYPE_RANGE:
+      p->data.range.x = (char)mpca_image_get_int(in);
+      p->data.range.y = (char)mpca_image_get_int(in);
+      break;
+    
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SKIP:
+      p->data.oneof.x = mpca_image_get_str(in);
+      if (p->data.oneof.x == NULL) { p->data.oneof.x = calloc(1, 1); }
+      mpc_class_init(p->data.oneof.set, p->data.oneof.x, type == MPC_TYPE_NONEOF);
+      break;
+    
+    case MPC_TYPE_APPLY:
+      p->data.apply.x = mpca_image_get_parser(in);
+      p->data.apply.f = (mpc_apply_t)mpca_image_get_fn(in);
+      break;
+    
+    case MPC_TYPE_APPLY_TO:
+      p->data.apply_to.x = mpca_image_get_parser(in);
+      p->data.apply_to.f = (mpc_apply_to_t)mpca_image_get_fn(in);
+      p->data.apply_to.d = mpca_image_get_data(in);
+      break;
+    
+    case MPC_TYPE_CHECK:
+      p->data.check.x = mpca_image_get_parser(in);
+      p->data.check.f = (mpc_check_t)mpca_image_get_fn(in);
+      p->data.check.e = mpca_image_get_str(in);
+      break;
+    
+    case MPC_TYPE_CHECK_WITH:
+      p->data.check_with.x = mpca_image_get_parser(in);
+      p->data.check_with.f = (mpc_check_with_t)mpca_image_get_fn(in);
+      p->data.check_with.d = NULL;
+      p->data.check_with.e = mpca_image_get_str(in);
+      break;
+    
+    case MPC_TYPE_PREDICT: p->data.predict.x = mpca_image_get_parser(in); break;
+    case MPC_TYPE_SPAN:    p->data.span.x = mpca_image_get_parser(in);    break;
+    
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      p->data.not.x = mpca_image_get_parser(in);
+      p->data.not.dx = (mpc_dtor_t)mpca_image_get_fn(in);
+      p->data.not.lf = (mpc_ctor_t)mpca_image_get_fn(in);
+      break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      p->data.repeat.n = mpca_image_get_int(in);
+      p->data.repeat.f = (mpc_fold_t)mpca_image_get_fn(in);
+      p->data.repeat.x = mpca_image_get_parser(in);
+      p->data.repeat.dx = (mpc_dtor_t)mpca_image_get_fn(in);
+      break;
+    
+    case MPC_TYPE_OR:
+      p->data.or.n = mpca_image_get_count(in, 4);
+      p->data.or.xs = malloc(sizeof(mpc_parser_t*) * (p->data.or.n + 1));
+      for (i = 0; i < p->data.or.n; i++) { p->data.or.xs[i] = mpca_image_get_parser(in); }
+      p->data.or.dispatch = NULL;
+      if (mpca_image_get_int(in)) {
+        p->data.or.dispatch = malloc(257 * ((p->data.or.n + 7) / 8));
+        mpca_image_get_bytes(in, p->data.or.dispatch, 257 * ((p->data.or.n + 7) / 8));
+      }
+      break;
+    
+    case MPC_TYPE_AND:
+      p->data.and.n = mpca_image_get_count(in, 4);
+      p->data.and.f = (mpc_fold_t)mpca_image_get_fn(in);
+      p->data.and.xs = malloc(sizeof(mpc_parser_t*) * (p->data.and.n + 1));
+      p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (p->data.and.n + 1));
+      for (i = 0; i < p->data.and.n; i++) { p->data.and.xs[i] = mpca_image_get_parser(in); }
+      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = (mpc_dtor_t)mpca_image_get_fn(in); }
+      break;
+    
+    case MPC_TYPE_DFA:
+      p->data.dfa.n = mpca_image_get_count(in, 1);
+      p->data.dfa.classes = mpca_image_get_count(in, 1);
+      if (p->data.dfa.n < 1 || p->data.dfa.classes < 1
+      ||  p->data.dfa.n > (int)((in->length - in->pos) / 4 / p->data.dfa.classes)) {
+        if (!in->err) { in->err = "Image is corrupt!"; }
+        p->data.dfa.n = 0;
+      }
+      p->data.dfa.map = malloc(256);
+      p->data.dfa.next = malloc(sizeof(int) * (p->data.dfa.n * p->data.dfa.classes + 1));
+      p->data.dfa.accept = malloc(p->data.dfa.n + 1);
+      p->data.dfa.expected = malloc(sizeof(char*) * (p->data.dfa.n + 1));
+      mpca_image_get_bytes(in, p->data.dfa.map, 256);
+      for (i = 0; i < 256; i++) {
+        if (p->data.dfa.map[i] >= p->data.dfa.classes) { p->data.dfa.map[i] = 0; }
+      }
+      for (i = 0; i < p->data.dfa.n * p->data.dfa.classes; i++) {
+        p->data.dfa.next[i] = mpca_image_get_int(in);
+        if (p->data.dfa.next[i] < -1 || p->data.dfa.next[i] >= p->data.dfa.n) { p->data.dfa.next[i] = -1; }
+      }
+      mpca_image_get_bytes(in, p->data.dfa.accept, p->data.dfa.n);
+      for (i = 0; i < p->data.dfa.n; i++) { p->data.dfa.expected[i] = mpca_image_get_str(in); }
+      break;
+    
+    case MPC_TYPE_TRIE:
+      p->data.trie.n = mpca_image_get_count(in, 8);
+      if (p->data.trie.n < 1 && !in->err) { in->err = "Image is corrupt!"; }
+      p->data.trie.xs = malloc(sizeof(char*) * (p->data.trie.n + 1));
+      p->data.trie.ms = malloc(sizeof(char*) * (p->data.trie.n + 1));
+      for (i = 0; i < p->data.trie.n; i++) {
+        p->data.trie.xs[i] = mpca_image_get_str(in);
+        p->data.trie.ms[i] = mpca_image_get_str(in);
+        if (p->data.trie.xs[i] == NULL) { p->data.trie.xs[i] = calloc(1, 1); }
+        if (p->data.trie.ms[i] == NULL) { p->data.trie.ms[i] = calloc(1, 1); }
+      }
+      mpc_trie_build(&p->data.trie);
+      break;
+    
+    default: break;
+  }
+  
+}
+
+mpc_err_t *mpca_lang_image(const void *image, size_t length, const mpca_action_def_t *actions, mpc_dtor_t dtor, int n, ...) {
+  
+  int j;
+  long hash, stamp[MPCA_IMAGE_STAMP_NUM];
+  mpca_image_in_t in;
+  char magic[4];
+  
+  va_list va;
+  va_start(va, n);
+  
+  in.s = image;
+  in.length = length;
+  in.pos = 0;
+  in.actions = actions;
+  in.dtor = dtor;
+  in.err = NULL;
+  
+  mpca_image_get_bytes(&in, magic, 4);
+  if (!in.err && memcmp(magic, "MPCI", 4) != 0) { in.err = "Not a grammar image!"; }
+  if (mpca_image_get_int(&in) != MPCA_IMAGE_VERSION && !in.err) { in.err = "Image is from another version of mpc!"; }
+  mpca_image_stamp(stamp);
+  for (j = 0; j < MPCA_IMAGE_STAMP_NUM; j++) {
+    if (mpca_image_get_int(&in) != stamp[j] && !in.err) { in.err = "Image is from another build of mpc!"; }
+  }
+  
+  /* The hash at the end covers everything before it */
+  if (!in.err && length < 4) { in.err = "Image is truncated!"; }
+  if (!in.err) {
+    hash = (long)(mpca_image_hash_bytes(2166136261ul, in.s, length - 4) & 0x7FFFFFFFul);
+    j = (int)in.pos;
+    in.pos = length - 4;
+    if (mpca_image_get_int(&in) != hash) { in.err = "Image is corrupt!"; }
+    in.length = length - 4;
+    in.pos = j;
+  }
+  
+  if (mpca_image_get_int(&in) != n && !in.err) { in.err = "Image has a different number of parsers!"; }
+  
+  /* Only the `n` given are read, nothing is defined if the image is wrong */
+  in.ps = malloc(sizeof(mpc_parser_t*) * (n + 1));
+  for (j = 0; j < n; j++) { in.ps[j] = va_arg(va, mpc_parser_t*); }
+  in.n = in.err ? 0 : n;
+  for (j = 0; j < in.n; j++) {
+    if (in.ps[j] == NULL || !in.ps[j]->retained) {
+      if (!in.err) { in.err = "Parsers given don't match the image!"; }
+      in.n = j;
+    }
+  }
+  for (j = 0; j < in.n; j++) { mpca_image_get_def(&in, in.ps[j], mpca_image_get_int(&in)); }
+  
+  if (in.err) {
+    for (j = 0; j < in.n; j++) { mpc_undefine(in.ps[j]); }
+  }
+  
+  free(in.ps);
+  va_end(va);
+  return in.err ? mpc_err_file("<mpca_lang_image>", in.err) : NULL;
+}
+
 static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
 
   int i, total;
@@ -3747,6 +7332,7 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)     { return 1 + mpc_nodecount_unretained(p->data.span.x, 0); }
 
   if (p->type == MPC_TYPE_CHECK)    { return 1 + mpc_nodecount_unretained(p->data.check.x, 0); }
   if (p->type == MPC_TYPE_CHECK_WITH) { return 1 + mpc_nodecount_unretained(p->data.check_with.x, 0); }
@@ -3778,10 +7364,270 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   
 }
 
+static int mpc_optimise_fold(mpc_fold_t f) {
+  return f == mpcf_fold_ast || f == mpcaf_vals_fold;
+}
+
+static mpc_dtor_t mpc_optimise_fold_dtor(mpc_fold_t f) {
+  return f == mpcf_fold_ast ? (mpc_dtor_t)mpc_ast_delete : mpca_vals_delete;
+}
+
+static void mpc_altcount_unretained(mpc_parser_t* p, int force, int *alts) {
+  
+  int i;
+  
+  if (p->retained && !force) { return; }
+  
+  if (p->type == MPC_TYPE_EXPECT)     { mpc_altcount_unretained(p->data.expect.x, 0, alts); }
+  if (p->type == MPC_TYPE_APPLY)      { mpc_altcount_unretained(p->data.apply.x, 0, alts); }
+  if (p->type == MPC_TYPE_APPLY_TO)   { mpc_altcount_unretained(p->data.apply_to.x, 0, alts); }
+  if (p->type == MPC_TYPE_PREDICT)    { mpc_altcount_unretained(p->data.predict.x, 0, alts); }
+  if (p->type == MPC_TYPE_SPAN)       { mpc_altcount_unretained(p->data.span.x, 0, alts); }
+  if (p->type == MPC_TYPE_CHECK)      { mpc_altcount_unretained(p->data.check.x, 0, alts); }
+  if (p->type == MPC_TYPE_CHECK_WITH) { mpc_altcount_unretained(p->data.check_with.x, 0, alts); }
+  if (p->type == MPC_TYPE_NOT)        { mpc_altcount_unretained(p->data.not.x, 0, alts); }
+  if (p->type == MPC_TYPE_MAYBE)      { mpc_altcount_unretained(p->data.not.x, 0, alts); }
+  if (p->type == MPC_TYPE_MANY)       { mpc_altcount_unretained(p->data.repeat.x, 0, alts); }
+  if (p->type == MPC_TYPE_MANY1)      { mpc_altcount_unretained(p->data.repeat.x, 0, alts); }
+  if (p->type == MPC_TYPE_COUNT)      { mpc_altcount_unretained(p->data.repeat.x, 0, alts); }
+  
+  if (p->type == MPC_TYPE_AND) {
+    for (i = 0; i < p->data.and.n; i++) {
+      mpc_altcount_unretained(p->data.and.xs[i], 0, alts);
+    }
+  }
+  
+  if (p->type == MPC_TYPE_OR) {
+    for (i = 0; i < p->data.or.n; i++) {
+      mpc_altcount_unretained(p->data.or.xs[i], 0, alts);
+    }
+    (*alts) += p->data.or.n;
+  }
+  
+}
+
 void mpc_stats(mpc_parser_t* p) {
+  int alts = 0;
+  mpc_altcount_unretained(p, 1, &alts);
   printf("Stats\n");
   printf("=====\n");
   printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
+  printf("Or Alternatives: %i\n", alts);
+#ifdef MPC_STATS
+  printf("Ors Parsed: %li\n", mpc_or_totals.ors);
+  printf("Or Alternatives Tried: %li\n", mpc_or_totals.tried);
+  printf("Or Alternatives Skipped: %li\n", mpc_or_totals.skipped);
+  if (mpc_or_totals.ors) {
+    printf("Or Alternatives Tried Per Or: %.2f\n", (double)mpc_or_totals.tried / mpc_or_totals.ors);
+  }
+#endif
+}
+
+#ifdef MPC_STATS
+
+void mpc_or_stats(mpc_or_stats_t *s) {
+  *s = mpc_or_totals;
+}
+
+void mpc_or_stats_reset(void) {
+  memset(&mpc_or_totals, 0, sizeof(mpc_or_stats_t));
+}
+
+void mpc_mem_config(int blocks) {
+  mpc_mem_blocks = blocks > 0 ? blocks : MPC_INPUT_MEM_MAX;
+}
+
+void mpc_mem_stats(mpc_mem_stats_t *s) {
+  *s = mpc_mem_totals;
+}
+
+void mpc_mem_stats_reset(void) {
+  memset(&mpc_mem_totals, 0, sizeof(mpc_mem_stats_t));
+}
+
+#endif
+
+/*
+** Alternatives of an `or` that are each a literal
+** put together the same way, as the keywords and
+** symbols of a rule are, get merged into one trie.
+** So that nothing else changes, the literal must be
+** what is read first and everything else must not
+** be able to fail, which makes each alternative
+** succeed just when its literal does. Above it can
+** only be applies, and `and`s with parts that read
+** nothing before it and parts after it like the
+** whitespace `mpc_tok` skips. Nested `or`s are done
+** from the inside out, so a trie can be merged again.
+*/
+
+static int mpc_trie_literal(mpc_parser_t *p) {
+  mpc_parser_t *x;
+  if (p->retained || p->memo) { return 0; }
+  if (p->type == MPC_TYPE_TRIE) { return 1; }
+  if (p->type != MPC_TYPE_EXPECT) { return 0; }
+  x = p->data.expect.x;
+  if (x->retained || x->memo) { return 0; }
+  return (x->type == MPC_TYPE_STRING && x->data.string.x[0] != '\0')
+    ||   (x->type == MPC_TYPE_SINGLE && x->data.single.x != '\0');
+}
+
+static int mpc_trie_nofail(mpc_parser_t *p, int idle) {
+  if (p->retained || p->memo) { return 0; }
+  switch (p->type) {
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:  return 1;
+    case MPC_TYPE_SKIP:   return !idle;
+    case MPC_TYPE_EXPECT: return mpc_trie_nofail(p->data.expect.x, idle);
+    default: return 0;
+  }
+}
+
+static mpc_parser_t *mpc_trie_find(mpc_parser_t *p) {
+  
+  int j, k;
+  mpc_parser_t *x = NULL;
+  
+  if (mpc_trie_literal(p)) { return p; }
+  if (p->retained || p->memo) { return NULL; }
+  
+  switch (p->type) {
+    case MPC_TYPE_APPLY:    return mpc_trie_find(p->data.apply.x);
+    case MPC_TYPE_APPLY_TO: return mpc_trie_find(p->data.apply_to.x);
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        x = mpc_trie_find(p->data.and.xs[j]);
+        if (x) { break; }
+        if (!mpc_trie_nofail(p->data.and.xs[j], 1)) { return NULL; }
+      }
+      for (k = j + 1; k < p->data.and.n; k++) {
+        if (!mpc_trie_nofail(p->data.and.xs[k], 0)) { return NULL; }
+      }
+      return x;
+    default: return NULL;
+  }
+  
+}
+
+static int mpc_trie_equal(mpc_parser_t *a, mpc_parser_t *b) {
+  if (a->type != b->type) { return 0; }
+  switch (a->type) {
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL: return a->data.lift.lf == b->data.lift.lf && a->data.lift.x == b->data.lift.x;
+    case MPC_TYPE_SKIP:     return strcmp(a->data.oneof.x, b->data.oneof.x) == 0;
+    case MPC_TYPE_EXPECT:
+      return strcmp(a->data.expect.m, b->data.expect.m) == 0
+        && mpc_trie_equal(a->data.expect.x, b->data.expect.x);
+    default: return 1;
+  }
+}
+
+/* Both must have a literal `mpc_trie_find` can find */
+static int mpc_trie_same(mpc_parser_t *a, mpc_parser_t *b) {
+  
+  int j, fa, fb;
+  
+  if (mpc_trie_literal(a) || mpc_trie_literal(b)) { return mpc_trie_literal(a) && mpc_trie_literal(b); }
+  if (a->type != b->type) { return 0; }
+  
+  switch (a->type) {
+    case MPC_TYPE_APPLY:
+      return a->data.apply.f == b->data.apply.f
+        && mpc_trie_same(a->data.apply.x, b->data.apply.x);
+    case MPC_TYPE_APPLY_TO:
+      return a->data.apply_to.f == b->data.apply_to.f && a->data.apply_to.d == b->data.apply_to.d
+        && mpc_trie_same(a->data.apply_to.x, b->data.apply_to.x);
+    case MPC_TYPE_AND:
+      if (a->data.and.n != b->data.and.n || a->data.and.f != b->data.and.f) { return 0; }
+      for (j = 0; j < a->data.and.n-1; j++) {
+        if (a->data.and.dxs[j] != b->data.and.dxs[j]) { return 0; }
+      }
+      for (j = 0; j < a->data.and.n; j++) {
+        fa = mpc_trie_find(a->data.and.xs[j]) != NULL;
+        fb = mpc_trie_find(b->data.and.xs[j]) != NULL;
+        if (fa != fb) { return 0; }
+        if (fa && !mpc_trie_same(a->data.and.xs[j], b->data.and.xs[j])) { return 0; }
+        if (!fa && !mpc_trie_equal(a->data.and.xs[j], b->data.and.xs[j])) { return 0; }
+      }
+      return 1;
+    default: return 0;
+  }
+  
+}
+
+/* Merges the first run of alternatives there is, keeping the first in place of them all */
+static int mpc_optimise_trie(mpc_parser_t *p) {
+  
+  int j, k, m, l;
+  mpc_parser_t *x, *y;
+  mpc_pdata_trie_t d;
+  
+  for (j = 0, k = 0; j < p->data.or.n; j = k) {
+    k = j + 1;
+    if (mpc_trie_find(p->data.or.xs[j]) == NULL) { continue; }
+    while (k < p->data.or.n
+    &&     mpc_trie_find(p->data.or.xs[k])
+    &&     mpc_trie_same(p->data.or.xs[j], p->data.or.xs[k])) { k++; }
+    if (k - j > 1) { break; }
+  }
+  
+  if (j >= p->data.or.n) { return 0; }
+  
+  d.n = 0;
+  for (m = j; m < k; m++) {
+    y = mpc_trie_find(p->data.or.xs[m]);
+    d.n += y->type == MPC_TYPE_TRIE ? y->data.trie.n : 1;
+  }
+  
+  d.xs = malloc(sizeof(char*) * d.n);
+  d.ms = malloc(sizeof(char*) * d.n);
+  for (m = j, d.n = 0; m < k; m++) {
+    
+    y = mpc_trie_find(p->data.or.xs[m]);
+    
+    if (y->type == MPC_TYPE_TRIE) {
+      for (l = 0; l < y->data.trie.n; l++, d.n++) {
+        d.xs[d.n] = malloc(strlen(y->data.trie.xs[l]) + 1);
+        strcpy(d.xs[d.n], y->data.trie.xs[l]);
+        d.ms[d.n] = malloc(strlen(y->data.trie.ms[l]) + 1);
+        strcpy(d.ms[d.n], y->data.trie.ms[l]);
+      }
+      continue;
+    }
+    
+    x = y->data.expect.x;
+    if (x->type == MPC_TYPE_STRING) {
+      d.xs[d.n] = malloc(strlen(x->data.string.x) + 1);
+      strcpy(d.xs[d.n], x->data.string.x);
+    } else {
+      d.xs[d.n] = malloc(2);
+      d.xs[d.n][0] = x->data.single.x;
+      d.xs[d.n][1] = '\0';
+    }
+    d.ms[d.n] = malloc(strlen(y->data.expect.m) + 1);
+    strcpy(d.ms[d.n], y->data.expect.m);
+    d.n++;
+  }
+  mpc_trie_build(&d);
+  
+  mpc_undefine_or_dispatch(p);
+  
+  y = mpc_trie_find(p->data.or.xs[j]);
+  if (y->type == MPC_TYPE_TRIE) {
+    mpc_undefine_trie(y);
+  } else {
+    mpc_delete(y->data.expect.x);
+    free(y->data.expect.m);
+  }
+  y->type = MPC_TYPE_TRIE;
+  y->data.trie = d;
+  
+  for (m = j + 1; m < k; m++) { mpc_delete(p->data.or.xs[m]); }
+  memmove(p->data.or.xs + j + 1, p->data.or.xs + k, (p->data.or.n - k) * sizeof(mpc_parser_t*));
+  p->data.or.n -= k - j - 1;
+  return 1;
 }
 
 static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
@@ -3799,6 +7645,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_unretained(p->data.check.x, 0); }
   if (p->type == MPC_TYPE_CHECK_WITH) { mpc_optimise_unretained(p->data.check_with.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)    { mpc_optimise_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)       { mpc_optimise_unretained(p->data.span.x, 0); }
   if (p->type == MPC_TYPE_NOT)        { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE)      { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MANY)       { mpc_optimise_unretained(p->data.repeat.x, 0); }
@@ -3826,6 +7673,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
     &&  p->data.or.xs[p->data.or.n-1]->type == MPC_TYPE_OR
     && !p->data.or.xs[p->data.or.n-1]->retained) {
       t = p->data.or.xs[p->data.or.n-1];
+      mpc_undefine_or_dispatch(p); mpc_undefine_or_dispatch(t);
       n = p->data.or.n; m = t->data.or.n;
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
@@ -3839,6 +7687,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
     &&  p->data.or.xs[0]->type == MPC_TYPE_OR
     && !p->data.or.xs[0]->retained) {
       t = p->data.or.xs[0];
+      mpc_undefine_or_dispatch(p); mpc_undefine_or_dispatch(t);
       n = p->data.or.n; m = t->data.or.n;
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
@@ -3853,7 +7702,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
     &&  p->data.and.n == 2
     &&  p->data.and.xs[0]->type == MPC_TYPE_PASS
     && !p->data.and.xs[0]->retained
-    &&  p->data.and.f == mpcf_fold_ast) {
+    &&  mpc_optimise_fold(p->data.and.f)) {
       t = p->data.and.xs[1];
       mpc_delete(p->data.and.xs[0]);
       free(p->data.and.xs); free(p->data.and.dxs); free(p->name);
@@ -3864,10 +7713,10 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
     
     /* Merge ast lhs `and` */
     if (p->type == MPC_TYPE_AND
-    &&  p->data.and.f == mpcf_fold_ast
+    &&  mpc_optimise_fold(p->data.and.f)
     &&  p->data.and.xs[0]->type == MPC_TYPE_AND
     && !p->data.and.xs[0]->retained
-    &&  p->data.and.xs[0]->data.and.f == mpcf_fold_ast) {
+    &&  p->data.and.xs[0]->data.and.f == p->data.and.f) {
       t = p->data.and.xs[0];
       n = p->data.and.n; m = t->data.and.n;
       p->data.and.n = n + m - 1;
@@ -3875,24 +7724,24 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
       memmove(p->data.and.xs + m, p->data.and.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
       memmove(p->data.and.xs, t->data.and.xs, m * sizeof(mpc_parser_t*));
-      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete; }
+      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = mpc_optimise_fold_dtor(p->data.and.f); }
       free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t); 
       continue;
     }
     
     /* Merge ast rhs `and` */
     if (p->type == MPC_TYPE_AND
-    &&  p->data.and.f == mpcf_fold_ast
+    &&  mpc_optimise_fold(p->data.and.f)
     &&  p->data.and.xs[p->data.and.n-1]->type == MPC_TYPE_AND
     && !p->data.and.xs[p->data.and.n-1]->retained
-    &&  p->data.and.xs[p->data.and.n-1]->data.and.f == mpcf_fold_ast) {
+    &&  p->data.and.xs[p->data.and.n-1]->data.and.f == p->data.and.f) {
       t = p->data.and.xs[p->data.and.n-1];
       n = p->data.and.n; m = t->data.and.n;
       p->data.and.n = n + m - 1;
       p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m -1));
       p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
       memmove(p->data.and.xs + n - 1, t->data.and.xs, m * sizeof(mpc_parser_t*));
-      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete; }
+      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = mpc_optimise_fold_dtor(p->data.and.f); }
       free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t); 
       continue;
     }
@@ -3947,13 +7796,206 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       continue;
     }
     
+    /* Merge literal alternatives */
+    if (p->type == MPC_TYPE_OR && mpc_optimise_trie(p)) { continue; }
+    
     return;
     
   }
   
 }
 
+/*
+** FIRST sets for the `or` dispatch tables. Each
+** gives the characters a parser could start by
+** reading, and returns whether it could get anywhere
+** without reading one, or else whether it depends on
+** something other than the next character. That is
+** anything this doesn't look inside of, such as
+** anchors, lookahead and failures. Either way it then
+** has to be tried on every character. Rules can refer
+** to each other in circles, so the search is cut short
+** and gives up after a while.
+*/
+
+enum {
+  MPC_FIRST_EMPTY  = 1,
+  MPC_FIRST_OPAQUE = 2,
+  MPC_FIRST_BUDGET = 4096
+};
+
+static void mpc_first_add(unsigned char *set, int c) { set[c / 8] |= 1 << (c % 8); }
+static int mpc_first_has(const unsigned char *set, int c) { return (set[c / 8] >> (c % 8)) & 1; }
+
+static int mpc_first(mpc_parser_t *p, unsigned char *set, int *budget) {
+  
+  int j, f, g;
+  
+  if (--(*budget) < 0) {
+    memset(set, 0xFF, 32);
+    return MPC_FIRST_EMPTY | MPC_FIRST_OPAQUE;
+  }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SATISFY:
+      memset(set, 0xFF, 32);
+      return 0;
+    
+    case MPC_TYPE_SINGLE:
+      mpc_first_add(set, (unsigned char)p->data.single.x);
+      return 0;
+    
+    case MPC_TYPE_RANGE:
+      for (j = 0; j < 256; j++) {
+        if ((char)j >= p->data.range.x && (char)j <= p->data.range.y) { mpc_first_add(set, j); }
+      }
+      return 0;
+    
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      for (j = 0; j < 32; j++) { set[j] |= p->data.oneof.set[j]; }
+      return 0;
+    
+    case MPC_TYPE_SKIP:
+      for (j = 0; j < 32; j++) { set[j] |= p->data.oneof.set[j]; }
+      return MPC_FIRST_EMPTY;
+    
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0] == '\0') { return MPC_FIRST_EMPTY; }
+      mpc_first_add(set, (unsigned char)p->data.string.x[0]);
+      return 0;
+    
+    case MPC_TYPE_DFA:
+      for (j = 0; j < 256; j++) {
+        if (p->data.dfa.next[p->data.dfa.map[j]] >= 0) { mpc_first_add(set, j); }
+      }
+      return p->data.dfa.accept[0] ? MPC_FIRST_EMPTY : 0;
+    
+    case MPC_TYPE_TRIE:
+      for (j = 0; j < p->data.trie.n; j++) {
+        if (p->data.trie.xs[j][0] == '\0') { return MPC_FIRST_EMPTY; }
+        mpc_first_add(set, (unsigned char)p->data.trie.xs[j][0]);
+      }
+      return 0;
+    
+    /* These always succeed without reading anything */
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+      return MPC_FIRST_EMPTY;
+    
+    case MPC_TYPE_EXPECT:     return mpc_first(p->data.expect.x, set, budget);
+    case MPC_TYPE_APPLY:      return mpc_first(p->data.apply.x, set, budget);
+    case MPC_TYPE_APPLY_TO:   return mpc_first(p->data.apply_to.x, set, budget);
+    case MPC_TYPE_PREDICT:    return mpc_first(p->data.predict.x, set, budget);
+    case MPC_TYPE_SPAN:       return mpc_first(p->data.span.x, set, budget);
+    case MPC_TYPE_CHECK:      return mpc_first(p->data.check.x, set, budget);
+    case MPC_TYPE_CHECK_WITH: return mpc_first(p->data.check_with.x, set, budget);
+    
+    case MPC_TYPE_MAYBE: return mpc_first(p->data.not.x, set, budget) | MPC_FIRST_EMPTY;
+    case MPC_TYPE_MANY:  return mpc_first(p->data.repeat.x, set, budget) | MPC_FIRST_EMPTY;
+    case MPC_TYPE_MANY1: return mpc_first(p->data.repeat.x, set, budget);
+    
+    case MPC_TYPE_COUNT:
+      f = mpc_first(p->data.repeat.x, set, budget);
+      return p->data.repeat.n == 0 ? f | MPC_FIRST_EMPTY : f;
+    
+    case MPC_TYPE_OR:
+      f = 0;
+      for (j = 0; j < p->data.or.n; j++) {
+        f |= mpc_first(p->data.or.xs[j], set, budget);
+      }
+      return f;
+    
+    case MPC_TYPE_AND:
+      f = 0;
+      for (j = 0; j < p->data.and.n; j++) {
+        g = mpc_first(p->data.and.xs[j], set, budget);
+        f |= g & MPC_FIRST_OPAQUE;
+        if (!(g & MPC_FIRST_EMPTY)) { return f; }
+      }
+      return f | MPC_FIRST_EMPTY;
+    
+    default:
+      memset(set, 0xFF, 32);
+      return MPC_FIRST_EMPTY | MPC_FIRST_OPAQUE;
+  }
+  
+}
+
+static void mpc_optimise_or_dispatch(mpc_parser_t *p) {
+  
+  int j, k, budget;
+  int w = (p->data.or.n + 7) / 8;
+  unsigned char set[32];
+  
+  mpc_undefine_or_dispatch(p);
+  if (p->data.or.n == 0) { return; }
+  
+  p->data.or.dispatch = calloc(257, w);
+  
+  for (j = 0; j < p->data.or.n; j++) {
+    
+    memset(set, 0, sizeof(set));
+    budget = MPC_FIRST_BUDGET;
+    
+    if (mpc_first(p->data.or.xs[j], set, &budget)) {
+      memset(set, 0xFF, sizeof(set));
+      p->data.or.dispatch[256 * w + j / 8] |= 1 << (j % 8);
+    }
+    
+    for (k = 0; k < 256; k++) {
+      if (mpc_first_has(set, k)) { p->data.or.dispatch[k * w + j / 8] |= 1 << (j % 8); }
+    }
+  }
+  
+}
+
+static void mpc_optimise_dispatch(mpc_parser_t *p, int force) {
+  
+  int i;
+  
+  if (p->retained && !force) { return; }
+  
+  if (p->type == MPC_TYPE_EXPECT)     { mpc_optimise_dispatch(p->data.expect.x, 0); }
+  if (p->type == MPC_TYPE_APPLY)      { mpc_optimise_dispatch(p->data.apply.x, 0); }
+  if (p->type == MPC_TYPE_APPLY_TO)   { mpc_optimise_dispatch(p->data.apply_to.x, 0); }
+  if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_dispatch(p->data.check.x, 0); }
+  if (p->type == MPC_TYPE_CHECK_WITH) { mpc_optimise_dispatch(p->data.check_with.x, 0); }
+  if (p->type == MPC_TYPE_PREDICT)    { mpc_optimise_dispatch(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)       { mpc_optimise_dispatch(p->data.span.x, 0); }
+  if (p->type == MPC_TYPE_NOT)        { mpc_optimise_dispatch(p->data.not.x, 0); }
+  if (p->type == MPC_TYPE_MAYBE)      { mpc_optimise_dispatch(p->data.not.x, 0); }
+  if (p->type == MPC_TYPE_MANY)       { mpc_optimise_dispatch(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_MANY1)      { mpc_optimise_dispatch(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_COUNT)      { mpc_optimise_dispatch(p->data.repeat.x, 0); }
+  
+  if (p->type == MPC_TYPE_OR) {
+    for (i = 0; i < p->data.or.n; i++) {
+      mpc_optimise_dispatch(p->data.or.xs[i], 0);
+    }
+    mpc_optimise_or_dispatch(p);
+  }
+  
+  if (p->type == MPC_TYPE_AND) {
+    for (i = 0; i < p->data.and.n; i++) {
+      mpc_optimise_dispatch(p->data.and.xs[i], 0);
+    }
+  }
+  
+}
+
+/*
+** The dispatch tables look through to the rules an
+** `or` uses, so if any of those are defined later on
+** this should be run again once they are.
+*/
+
 void mpc_optimise(mpc_parser_t *p) {
   mpc_optimise_unretained(p, 1);
+  mpc_optimise_dispatch(p, 1);
 }
 
@@ -67,6 +67,7 @@ typedef struct mpc_parser_t mpc_parser_t;
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
 int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
+int mpc_parse_mmap(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
@@ -78,6 +79,7 @@ typedef void(*mpc_dtor_t)(mpc_val_t*);
 typedef mpc_val_t*(*mpc_ctor_t)(void);
 
 typedef mpc_val_t*(*mpc_apply_t)(mpc_val_t*);
+typedef mpc_val_t*(*mpc_copy_t)(mpc_val_t*);
 typedef mpc_val_t*(*mpc_apply_to_t)(mpc_val_t*,void*);
 typedef mpc_val_t*(*mpc_fold_t)(int,mpc_val_t**);
 
@@ -147,6 +149,76 @@ mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t *mpc_predictive(mpc_parser_t *a);
 
+/*
+** Memoization
+**
+** A memoized parser remembers how it did at 
+** each position of the input, so when a rule
+** using it backtracks and tries it again at
+** the same place the answer is looked up 
+** rather than parsed again. Successes are 
+** handed out as copies made with `copy` and
+** the remembered ones are deleted with `da`.
+** If `copy` is NULL only failures are kept.
+** A copy is only kept once the parser has 
+** had a success asked for twice, so input
+** that never backtracks over a success copies
+** nothing. The table has a fixed number of 
+** entries per parse and older ones are thrown
+** out, and what it holds is capped in bytes,
+** a kept copy counting as the input it matched.
+** Past the cap parses are run again instead.
+** Grammars from mpca_lang share kept trees
+** rather than copying them, so each costs a
+** node however deeply it is nested. Only
+** string and mmap inputs can jump about like
+** this, on files and pipes the parser just runs.
+*/
+
+mpc_parser_t *mpc_memoize(mpc_parser_t *a, mpc_copy_t copy, mpc_dtor_t da);
+
+/*
+** Depth Limit
+**
+** Parsers nest on a stack of their own rather 
+** than the C stack, so deeply nested input can't
+** crash the program. When `a` is parsed with it
+** nesting deeper than `n` parsers fails with a
+** "Maximum Parser Depth Exceeded!" error at that
+** point instead. The whole parse fails there, no
+** `or` or `maybe` can go round it. If `n` is zero
+** or it is never set, the limit is 100000.
+*/
+
+mpc_parser_t *mpc_max_depth(mpc_parser_t *a, int n);
+
+/*
+** Two Pass Parsing
+**
+** When `a` is parsed from a string or an mmapped
+** file with this set, it is parsed once without
+** building errors and again only if that fails,
+** which is quicker when most input is good. For
+** bad input the actions are called twice, so it
+** is off unless asked for. Files and pipes are
+** always parsed once.
+*/
+
+mpc_parser_t *mpc_two_pass(mpc_parser_t *a);
+
+/*
+** Spans
+**
+** A span returns the text `a` matched as one 
+** new string. While it runs `a` builds no values
+** of its own, so no characters are copied and no
+** folds, applies, lifts or destructors are called
+** until the single string is made at the end. Any
+** checks inside `a` are given NULL.
+*/
+
+mpc_parser_t *mpc_span(mpc_parser_t *a);
+
 /*
 ** Common Parsers
 */
@@ -260,20 +332,68 @@ mpc_val_t *mpcf_maths(int n, mpc_val_t** xs);
 
 /*
 ** Regular Expression Parsers
+**
+** When every choice in a regex can be made by
+** looking at the next character it is run as a
+** DFA, which matches exactly what the combinators
+** would. Its errors then list the characters it
+** could have taken next, such as "one of '-0123456789'"
+** rather than "'-' or one or more of one of '0123456789'",
+** and characters already in such a class aren't
+** listed again. Counts such as `{2}` are
+** always run by the combinators, since on failure
+** they don't give back what they read: `/(c{2}|a)/`
+** matches "ca", with the "a" as its result.
+**
+** Under `mpc_predictive` the combinators don't give
+** back what a failed choice read, which the DFA
+** can't copy, so there a DFA can match differently:
+** `/[0-9]+(\.[0-9]+)?/` then `/$/` accepts "9." with
+** the combinators and not as a DFA, and errors can
+** be at other places. `mpc_re_predictive` always
+** uses the combinators, and `mpca_lang` uses it for
+** grammars given `MPCA_LANG_PREDICTIVE`.
 */
 
 mpc_parser_t *mpc_re(const char *re);
+mpc_parser_t *mpc_re_predictive(const char *re);
   
 /*
 ** AST
 */
 
+/*
+** For grammars built by mpca_lang each rule gets an id, its position in the
+** list of parsers passed in (starting at 1). 'rule' is the id of the
+** innermost rule named in 'tag' (0 if none) and 'tags' has bit (1ul << id)
+** set for every rule named in 'tag' whose id fits in an unsigned long.
+*/
+
+/*
+** A tree made by parsing lives in an arena owned
+** by its root, and is all freed at once when the
+** root is passed to 'mpc_ast_delete'. Deleting a
+** node inside it does nothing, and adding one of
+** its nodes to another tree adds a copy, so use
+** 'mpc_ast_copy' on any part of it kept past the
+** root. 'arena' is NULL for nodes on the heap.
+** Tags in an arena are shared between nodes, so
+** change them with the 'mpc_ast_*tag' functions
+** rather than writing into 'tag'.
+*/
+
+struct mpc_ast_arena_t;
+typedef struct mpc_ast_arena_t mpc_ast_arena_t;
+
 typedef struct mpc_ast_t {
   char *tag;
   char *contents;
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  int rule;
+  unsigned long tags;
+  mpc_ast_arena_t *arena;
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
@@ -284,6 +404,7 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s);
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a);
 
 void mpc_ast_delete(mpc_ast_t *a);
 void mpc_ast_print(mpc_ast_t *a);
@@ -341,16 +462,64 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_MEMOIZE              = 4
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
 
 mpc_err_t *mpca_lang(int flags, const char *language, ...);
+
+/*
+** Grammar Actions
+**
+** `mpca_lang_actions` builds the same parsers as
+** `mpca_lang` from the same grammar text, but
+** instead of an AST each rule named in `actions`
+** returns the value made by its action. The
+** action gets the text matched by the literals
+** in the rule and the values of the rules with
+** actions it used, and owns those values. Rules
+** without an action pass on what they matched
+** to the rule using them, so the rule given to
+** `mpc_parse` must have an action. `dtor`
+** deletes the values of a failed parse.
+*/
+
+typedef mpc_val_t*(*mpca_action_t)(const char *text, int n, mpc_val_t **xs);
+
+typedef struct {
+  const char *name;
+  mpca_action_t action;
+} mpca_action_def_t;
+
+mpc_err_t *mpca_lang_actions(int flags, const char *language, const mpca_action_def_t *actions, mpc_dtor_t dtor, ...);
 mpc_err_t *mpca_lang_file(int flags, FILE *f, ...);
 mpc_err_t *mpca_lang_pipe(int flags, FILE *f, ...);
 mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...);
 
+/*
+** Grammar Images
+**
+** `mpca_lang_save` writes the `n` parsers given,
+** as defined by one of the `mpca_lang` functions,
+** to `f`. `mpca_lang_image` defines them again
+** from those bytes without parsing any grammar,
+** whether read back from a file or compiled in
+** with something like `xxd -i`. It takes the same
+** `n` parsers in the same order, and for a grammar
+** made by `mpca_lang_actions` the same `actions`
+** and `dtor`. Only what mpca builds can be saved,
+** and an image is only read by a build of mpc
+** with the same version, library functions,
+** parser types and struct sizes as the one that
+** wrote it. Images end in a hash of their bytes,
+** and one that doesn't match is refused.
+*/
+
+mpc_err_t *mpca_lang_save(FILE *f, int n, ...);
+mpc_err_t *mpca_lang_image(const void *image, size_t length, const mpca_action_def_t *actions, mpc_dtor_t dtor, int n, ...);
+
 /*
 ** Misc
 */
@@ -360,6 +529,54 @@ void mpc_print(mpc_parser_t *p);
 void mpc_optimise(mpc_parser_t *p);
 void mpc_stats(mpc_parser_t *p);
 
+/*
+** The `or` stats count how many times an `or` was
+** parsed, and how many of its alternatives were run
+** or skipped by the table `mpc_optimise` gives it,
+** over every parse finished since the last reset.
+** `mpc_stats` prints them after the counts for `p`.
+** Like the memory stats below they are only built
+** with MPC_STATS defined.
+*/
+
+typedef struct {
+  long ors;
+  long tried;
+  long skipped;
+} mpc_or_stats_t;
+
+#ifdef MPC_STATS
+void mpc_or_stats(mpc_or_stats_t *s);
+void mpc_or_stats_reset(void);
+#endif
+
+/*
+** Small values made while parsing come from a
+** pool of blocks owned by the input, sized to the
+** input and capped at 4096 blocks per size class,
+** or at `blocks` set by `mpc_mem_config` (0 puts
+** the default back). The stats count blocks taken from the pool, values
+** too large for it, values that missed because it
+** was full, and the most blocks used at once, over
+** every parse finished since the last reset. These
+** are shared by every parse, so they are only built
+** with MPC_STATS defined and shouldn't be used while
+** other threads are parsing.
+*/
+
+typedef struct {
+  long hits;
+  long fallbacks;
+  long exhausted;
+  long peak;
+} mpc_mem_stats_t;
+
+#ifdef MPC_STATS
+void mpc_mem_config(int blocks);
+void mpc_mem_stats(mpc_mem_stats_t *s);
+void mpc_mem_stats_reset(void);
+#endif
+
 int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
   int(*tester)(const void*, const void*), 
   mpc_dtor_t destructor, 
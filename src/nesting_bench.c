@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mpc.h"
+
+/*
+
+Nesting benchmark
+- times mpc parsing deeply nested S-expressions with the jlispy grammar,
+  where every level is an AND that marks and unmarks its start
+- the input is 300 S-expressions like ((((+ 1 2)))), nested 200 to 500
+  deep, 211500 bytes in all, made in memory so every run parses the same
+- one run parses it 20 times, the best and median of 9 runs are printed
+
+
+ build command
+ cc -std=c99 -Wall -O2 nesting_bench.c mpc.c -lm -o nesting_bench
+
+ ./nesting_bench runs 9 runs of 20 parses, ./nesting_bench parses runs
+ changes the counts
+*/
+
+
+//same grammar as parsing.c, without the actions
+static const char* grammar =
+	"                                                              \
+	number   : /-?[0-9]+/ ;                                        \
+	symbol   : \"list\" | \"head\" | \"tail\"                      \
+	         | \"join\" | \"eval\" | '+' | '-' | '*' | '/' ;       \
+	sexpr    : '('<expr>*')';                                      \
+	qexpr    : '{' <expr>* '}' ;                                   \
+	expr     : <number> | <symbol> | <sexpr> | <qexpr>;            \
+	jlispy   : /^/ <expr>* /$/ ;                                   \
+	";
+
+//the S-expressions, one per line, the depths step through 200 to 499
+static char* make_input(void){
+	long len = 0;
+	for(int k = 0; k < 300; k++){ len += 2 * (200 + (k * 37) % 300) + 6; }
+
+	char* s = malloc(len + 1);
+	char* c = s;
+	for(int k = 0; k < 300; k++){
+		int depth = 200 + (k * 37) % 300;
+		memset(c, '(', depth); c += depth;
+		memcpy(c, "+ 1 2", 5); c += 5;
+		memset(c, ')', depth); c += depth;
+		*c++ = '\n';
+	}
+	*c = '\0';
+	return s;
+
+}
+
+static int compare(const void* a, const void* b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char** argv){
+	int parses = argc > 1 ? atoi(argv[1]) : 20;
+	int runs = argc > 2 ? atoi(argv[2]) : 9;
+	if(parses <= 0){ parses = 1; }
+	if(runs <= 0){ runs = 1; }
+
+	mpc_parser_t* Number = mpc_new("number");
+	mpc_parser_t* Symbol = mpc_new("symbol");
+	mpc_parser_t* Sexpr = mpc_new("sexpr");
+	mpc_parser_t* Qexpr = mpc_new("qexpr");
+	mpc_parser_t* Expr = mpc_new("expr");
+	mpc_parser_t* Jlispy = mpc_new("jlispy");
+
+	mpc_err_t* err = mpca_lang(MPCA_LANG_DEFAULT, grammar,
+		Number, Symbol, Sexpr, Qexpr, Expr, Jlispy, NULL);
+	if(err){
+		mpc_err_print(err);
+		mpc_err_delete(err);
+		mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy);
+		return 1;
+	}
+	//parsed in two passes like parsing.c does
+	mpc_two_pass(Jlispy);
+
+	char* input = make_input();
+	double* times = malloc(sizeof(double) * runs);
+	int ok = 1;
+
+	for(int i = 0; i < runs && ok; i++){
+		clock_t start = clock();
+		for(int j = 0; j < parses && ok; j++){
+			mpc_result_t r;
+			if(mpc_parse("<nesting>", input, Jlispy, &r)){
+				mpc_ast_delete(r.output);
+			} else {
+				mpc_err_print(r.error);
+				mpc_err_delete(r.error);
+				ok = 0;
+			}
+		}
+		times[i] = (double)(clock() - start) / CLOCKS_PER_SEC;
+	}
+
+	if(ok){
+		qsort(times, runs, sizeof(double), compare);
+		printf("input:   %lu bytes\n", (unsigned long)strlen(input));
+		printf("best:    %.3fs for %d parses\n", times[0], parses);
+		printf("median:  %.3fs for %d parses\n", times[runs / 2], parses);
+	}
+
+	free(times);
+	free(input);
+	mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy);
+	return ok ? 0 : 1;
+
+}
@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include "mpc.h"
+#include "Lval.h"
+#include "Compile.h"
+#include "Reader.h"
 
 /*
 
@@ -32,7 +36,35 @@ Interactive prompt
 
 
  build command
- cc -std=c99 -Wall parsing.c mpc.c -ledit -lm -o parsing
+ cc -std=c99 -Wall parsing.c Lval.c Compile.c Reader.c mpc.c -ledit -lm -o parsing
+
+
+ compile mode
+ ./parsing -c script.lspy > script.c writes the script out as C, see Compile.c
+ ./compile_bench times it against lval_eval, see compile_bench.c
+
+
+ batch mode
+ ./parsing a.lspy b.lspy runs the scripts, printing the result of every top
+ level expression. Expressions are read, evaluated and freed one at a time,
+ so scripts can be far bigger than memory
+ piping into ./parsing runs stdin the same way, "-" as a file name does too
+ ./parsing -q leaves out the banner, in batch mode and at the prompt
+
+
+ input is read by the reader in Reader.c, which builds lvals directly
+ ./parsing -m reads with the mpc grammar instead (slower, builds a mpc_ast_t)
+ ./parsing -v reads with both and prints a warning if they disagree
+ these go before -c if both are used
+
+
+ grammar image
+ ./parsing -g jlispy.img loads the mpc grammar from jlispy.img instead of
+ parsing the grammar text, which is most of the startup time for -m and -v
+ the reader doesn't use the grammar, so without those it isn't built at all
+ the image is written the first time, and again if it is from another build
+ a file that isn't an image is never written over
+ ./grammar_bench times both ways of building it, see grammar_bench.c
 */
 
 
@@ -41,13 +73,16 @@ If compiled on a windows machine, we have defined our own functions for readline
 and add_history*/
 #ifdef _WIN32
 #include <string.h>
+#include <io.h>
+#define isatty _isatty
 
 //readline function for windows 
 char* readline(char* prompt){
 	static char buffer[2048];
 
 	fputs(prompt, stdout);
-	fgets(buffer, 2048, stdin);
+	//NULL at the end of input, like editline's readline
+	if(!fgets(buffer, 2048, stdin)){ return NULL; }
 
 	//malloc allocates the requested memory and returns a pointer to it.
 	char* cpy = malloc(strlen(buffer)+1);
@@ -67,516 +102,12 @@ void add_history(char* unused){}
 /* Preprocessor for Mac/Linux, includes the editline library */
 // __APPLE__ is the preprocessor term for MacOS
 #else
+#include <unistd.h>
 #include <editline/readline.h>
 #endif
 
 
 
-//Error handling, this struct will be used so that an expression will evaluate 
-//to a number or an error
-typedef struct lval{
-	//type determines whether the lval object is a number or an error
-	int type;
-	long num;
-
-	//err and sym types have some string data
-	char* err;
-	char* sym;
-
-	//counter and lval list 
-	//S-Expressions are variable length lists of other values.
-	//this will be stored in cell 
-
-	//lval with type SEXPR will use count and cell 
-	int count;
-	//we put 'struct' here because we dont want the pointer to refer to itself
-	struct lval** cell;
-
-
-
-}lval;
-
-//enum is used to assign names to an integer constant 
-//creates an enumeration of possible lval types 
-
-//Chapter 9: added 2 more types, LVAL_SYM, LVAL_SEXPR, for S-Expressions
-enum{LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR};
-
-//creates an enumeration of possible lval err values
-//enum{LERR_DIV_ZERO, LERR_BAD_OP, LERR_BAD_NUM}; //orignal Error enum 
-
-
-/* LVAL CONSTRUCTORS */
-//lval constructors now return a pointer to lval object, this will
-//make it easier to reference in a lval cell list
-
-//constructs a pointer to lval type number
-lval* lval_num(long x){
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_NUM;
-	v->num = x;
-	return v;
-
-}
-
-//constructs a pointer to lval type err
-lval* lval_err(char* x){
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_ERR;
-
-	//allocate memory to err string
-	//we add +1 because strlen() doesn't include the null terminator 
-	//thus we add +1 so that there is enough allocated space 
-	v->err = malloc(strlen(x) + 1);
-	//copies parameter to err
-	strcpy(v->err, x);
-	return v;
-
-}
-
-//constructs a pointer to a lval type symbol
-lval* lval_sym(char* s){
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_SYM;
-	v->sym = malloc(strlen(s) + 1);
-	strcpy(v->sym, s);
-	return v;
-
-}
-
-//constructs a pointer to a lval type sexpr with an empty  cell
-lval* lval_sexpr(void){
-	lval* v = malloc(sizeof(lval));
-	v->type = LVAL_SEXPR;
-	v->count = 0;
-	v->cell = NULL;
-	return v;
-
-}
-
-//constructor for Qexpr
-lval* lval_qexpr(void){
-	lval* v=malloc(sizeof(lval));
-	v->type = LVAL_QEXPR;
-	v->count = 0;
-	v->cell = NULL;
-	return v;
-
-}
-
-/* DEALLOCATOR FOR LVAL */
-void lval_del(lval* v){
-	switch(v->type){
-
-		//do nothing for number types
-		case LVAL_NUM: break;
-
-		//ERR and SYM, free allocated char memory
-		case LVAL_ERR:
-			free(v->err);
-			break;
-		case LVAL_SYM:
-			free(v->sym);
-			break;
-
-		//if lval type is LVAL_SEXPR or LVAL_QEXPR
-		case LVAL_SEXPR:
-		case LVAL_QEXPR:
-			//deallocates each lval in the cell
-			for(int i =0; i<v->count; i++){
-				lval_del(v->cell[i]);
-			}
-			//deallocates the memory to contain the pointers to lval
-			free(v->cell);	 
-		break;
-	}
-	//finally deallocates the pointer to v 
-	free(v);
-
-}
-
-/* READING EXPRESSION FUNCTIONS */
-
-//parsing though the mpc input tree, number values are
-//still strings, we need to convert them before we call our number constructor
-lval* lval_read_num(mpc_ast_t* t){
-	errno = 0;
-	//converts t's content to long
-	long x = strtol(t->contents, NULL, 10);
-	return errno != ERANGE ? lval_num(x) : lval_err("invalid_number");
-
-}
-
-//foward declaration
-lval* lval_add(lval* v, lval* y);
-
-//lval_read recurssion function, goes through mpc_ast_t tree
-//creates lval objects for according tags
-lval* lval_read(mpc_ast_t* t){
-
-	//if the tag of t is number or symbol, we directly return a lval* 
-	//base case 
-	if(strstr(t->tag, "number")){ return lval_read_num(t);}
-	if(strstr(t->tag, "symbol")){return lval_sym(t->contents);}
-
-	//if root (>) or sexpr then create an new lval type sexpr
-	lval* x = NULL;
-	if(strcmp(t->tag, ">") == 0){x = lval_sexpr();}
-	if(strstr(t->tag,"sexpr")){x = lval_sexpr();}
-	if(strstr(t->tag, "qexpr"))  { x = lval_qexpr(); }
-
-	//fills in lval type sexpr cell list 
-	for(int i =0; i<t->children_num; i++){
-		//if contents are the following, ingnore them and continue the loop
-		if(strcmp(t->children[i]->contents, "(" )==0){ continue; }
-		if(strcmp(t->children[i]->contents, ")" )==0){ continue; }
-		if(strcmp(t->children[i]->contents, "{")==0){ continue; }
-		if(strcmp(t->children[i]->contents, "}")==0){ continue; }
-		if(strcmp(t->children[i]->tag, "regex" )==0){ continue; }
-
-		//lval_read recursively called on the children
-		//added to x's cell
-		x = lval_add(x, lval_read(t->children[i]));
-
-	}
-	return x;
-
-}
-
-//adds lval y to lval v's cell
-lval* lval_add(lval* v, lval* y){
-	v->count++;
-	//reallocates the size of v
-	v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-	//sets the last cell in the list to y
-	v->cell[v->count-1] = y;
-
-	return v;
-}
-
-/* LVAL Printing Functions */
-
-//forward declaration of lval_print
-void lval_print(lval* v);
-
-//this function will be called when the lval type is SEXPR
-//open and close will be '(' and ')' from lval_print
-void lval_expr_print(lval* v, char open, char close){
-
-	//putchar writes a character to stdout
-	putchar(open);
-
-	//remember v will be the root of the tree
-	for(int i =0; i< v->count; i++){
-
-		//prints values within cell
-		lval_print(v->cell[i]);
-
-		//prints trailing space when element is not last 
-		if(i != (v->count-1)){
-			putchar(' ');
-		}
-	}
-	putchar(close);
-
-
-} 
-
-
-//prints out lval
-void lval_print(lval* v){
-	switch(v->type){
-		//lval type number case
-		case LVAL_NUM:
-			//prints the long value
-			printf("%li", v->num);
-			break;
-		case LVAL_ERR:
-			printf("Error: %s",v->err );
-			break;
-		case LVAL_SYM:
-			printf("%s", v->sym);
-			break;
-		case LVAL_SEXPR:
-			//if the lval is a sexpr, when we print, we encase it with ()
-			lval_expr_print(v, '(',')');
-			break;
-		case LVAL_QEXPR:
-			lval_expr_print(v, '{','}');
-			break;
-
-	}
-
-}
-
-void lval_println(lval* v){
-	lval_print(v);
-	putchar('\n');
-}
-
-lval* lval_eval(lval* v);
-lval* lval_pop(lval* v, int index);
-lval* lval_take(lval* v, int index);
-lval* builtin_op(lval* v, char* op);
-lval* builtin(lval* a, char* func);
-
-/* Eval functions */
-
-//evaluates the lval, starts by evaluating the children first
-//if any child is an error, return that lval
-//if the lval is an empty expression, hence (), return the lval directly 
-//if the lval is a single expression, hence (5), return the single expression
-lval* lval_eval_sexpr(lval* v){
-
-	//Evaluates children 
-	for(int i =0; i< v->count; i++){
-		//evaulates each children
-		//transforms each child and sets it in original cell 
-		v->cell[i] = lval_eval(v->cell[i]);
-
-	}
-
-	//checks children for errors, returns child if error found
-  	for (int i = 0; i < v->count; i++) {
-    	if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
-  	}
-
-	//checks empty expression
-	if(v->count == 0){ 
-
-		return v; 
-	}
-
-	//checks single expression
-	if(v->count == 1){
-		return lval_take(v,0);
-	}
-
-	//ensure first element is a symbol
-	//if not, return error
-	lval* f = lval_pop(v, 0);
-	if(f->type != LVAL_SYM){
-		lval_del(f);
-		lval_del(v);
-		return lval_err("S-Expression does not start with symbol");
-	}
-
-	//call builtin with operator
-	//evaluates lval with symbol
-	lval* result = builtin(v, f->sym);
-	lval_del(f);
-	return result;
-
-
-}
-
-lval* lval_eval(lval* v){
-	//evaluates sexpr expressions
-	if(v->type == LVAL_SEXPR){
-		return lval_eval_sexpr(v);
-	}
-	//return all other types 
-	return v;
-}
-
-//pops lval object at index from v's cell list
-//we popout the symbol, so that we can just have a "list" of numbers to
-//do the evalutation on
-lval* lval_pop(lval* v, int index){
-	//gets lval at index
-	lval* x = v->cell[index];
-
-	//shifts memory after lval at index is popped
-	memmove(&v->cell[index], &v->cell[index+1],sizeof(lval*) * (v->count-index-1) );
-
-	//descrease count after popping item
-	v->count--;
-
-	//reallocates lval cell memory
-	v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-
-	//return popped object
-	return x;
-
-}
-
-//gets the lval at index and deletes original lval object afterwards
-lval* lval_take(lval* v, int index){
-	lval* x = lval_pop(v, index);
-	lval_del(v);
-	return x;
-
-}
-
-//takes in a lval object which represents all the 
-lval* builtin_op(lval* a, char* op){
-
-	//checks if all objects in v are numbers
-	for(int i=0; i< a->count; i++){
-		if(a->cell[i]->type != LVAL_NUM){
-			lval_del(a);
-			return lval_err("Error: Cannot operator on non-numerics");
-		}
-	}
-
-	//pops the first element
-	//all evaluations will be stored in x
-	lval* x = lval_pop(a,0);
-
-	//if no arguments and sub then perform unary negation
-	//hence, if a is just a number with no other expressions and has a op of '-' 
-	//then we just make it negative
-	if((strcmp(op,"-") == 0 ) && a->count ==0){
-		x->num = -x->num;
-	}
-
-	//while there are still remaining elements 
-	while(a->count > 0){
-
-		//pops the next element
-		lval* y = lval_pop(a,0);
-
-		//strcmp returns 0 if the two strings are equal 
-		//returns a lval object with num equal to performed operation 
-		if(strcmp(op, "+") == 0){ x->num += y->num; }
-		else if(strcmp(op, "-") == 0){ x->num -= y->num; }
-		else if(strcmp(op, "*") == 0){ x->num *= y->num; }
-		else if(strcmp(op, "/") == 0){ 
-			if(y->num == 0){
-				return lval_err("Error: Division by Zero");
-				break;
-			}
-
-			x->num /= y->num; 
-		}
-		//deallocate y after evaluation
-		lval_del(y);
-	}
-	//deallocate a after evaluation
-	lval_del(a);
-	return x;
-
-
-}
-
-//MACRO: reprocessor statement for creating 
-//function-like-things that are evaluated before the program is compiled.
-//can be used to do better error checking
-//its like python assert statments 
-
-#define LASSERT(args, cond, err) \
-	if(!(cond)){lval_del(args); return lval_err(err);}
-
-//q expressions
-lval* builtin_head(lval* a){
-
-	//error checking
-
-	//the lval we are passing in essentially holds another lval object
-	//that will contain the data, hence, a lval object type qexpr will have 
-	//one lval object in it's cell with all the other numbers/expressions
-	LASSERT(a, a->count != 1,"Function 'head' passed too many arguments!");
-
-	LASSERT(a, a->cell[0]->type != LVAL_QEXPR, "Function 'head' passed incorrect types!");
-
-	LASSERT(a,a->cell[0]->count == 0, "Function 'head' passed {}!");
-
-	lval* v = lval_take(a, 0);
-	while(v->count > 1){
-		lval_del(lval_pop(v,1));
-
-	}
-	return v;
-
-
-
-}
-
-lval* builtin_tail(lval* a){
-	//error checking
-	LASSERT(a, a->count != 1,"Function 'head' passed too many arguments!");
-
-	LASSERT(a, a->cell[0]->type != LVAL_QEXPR, "Function 'head' passed incorrect types!");
-
-	LASSERT(a,a->cell[0]->count == 0, "Function 'head' passed {}!");
-
-	lval* v= lval_take(a,0);
-	//delete and return the first item 
-	lval_del(lval_pop(v,0));
-	return v;
-
-
-}
-
-//converts a s-expression into a q-expression
-lval* builtin_list(lval* a){
-	a->type = LVAL_QEXPR;
-	return a;
-
-}
-
-//converts q-expression to s-expression
-lval* builtin_eval(lval* a){
-	//error checking
-	LASSERT(a, a->count != 1,"Function 'head' passed too many arguments!");
-
-	LASSERT(a, a->cell[0]->type != LVAL_QEXPR, "Function 'head' passed incorrect types!");
-
-	//gets the stored values
-	lval* x = lval_take(a,0);
-
-	//converts the stored lval into type LVAL_SEXPR
-	x->type = LVAL_SEXPR;
-	return lval_eval(x);
-
-
-
-}
-
-lval* lval_join(lval* x, lval* y);
-
-//first check if all arguments are q expressions
-//then we join them one by one
-lval* builtin_join(lval* a){
-
-	//checks if all arguments are q-expressions
-	for(int i=0; i<a->count; i++){
-		LASSERT(a, a->cell[i]->type != LVAL_QEXPR, "Function 'head' passed incorrect types!");
-
-	}
-
-	//the lval expressions will be joined into x
-	lval* x = lval_pop(a, 0);
-	while(a->count){
-		x=lval_join(x, lval_pop(a,0));
-	}
-
-	lval_del(a);
-	return x;
-
-}
-
-lval* lval_join(lval* x, lval* y){
-	while(y->count){
-		x = lval_add(x, lval_pop(y,0));
-
-	}
-	lval_del(y);
-	return x;
-
-}
-
-lval* builtin(lval* a, char* func){
-	if (strcmp("list", func) == 0) { return builtin_list(a); }
-    if (strcmp("head", func) == 0) { return builtin_head(a); }
- 	if (strcmp("tail", func) == 0) { return builtin_tail(a); }
-    if (strcmp("join", func) == 0) { return builtin_join(a); }
-    if (strcmp("eval", func) == 0) { return builtin_eval(a); }
-    if (strstr("+-/*", func)) { return builtin_op(a, func); }
-    lval_del(a);
-    return lval_err("Unknown Function!");
-}
-
 // //does the math evaluation between x y and the operator 
 // lval eval_op(lval x, char* op, lval y){
 // 	//if either x or y type is error, return it
@@ -643,36 +174,182 @@ lval* builtin(lval* a, char* func){
 // }
 
 
-int main(int argc, char** argv){
+//reads with the mpc grammar, how input was read before Reader.c
+//the grammar's actions build the lvals, so the output is already a lval
+//if input is NULL, f is read instead, or the file filename if f is NULL too
+//files are mapped into memory rather than read a character at a time
+static lval* read_mpc(char* filename, char* input, FILE* f, mpc_parser_t* Jlispy){
+	mpc_result_t r;
+	int ok = input ? mpc_parse(filename, input, Jlispy, &r)
+		: f ? mpc_parse_mmap(filename, f, Jlispy, &r)
+		: mpc_parse_contents(filename, Jlispy, &r);
+
+	if(!ok){
+		//same message mpc_err_print gives, without the newline
+		char* msg = mpc_err_string(r.error);
+		msg[strlen(msg)-1] = '\0';
+		lval* x = lval_err(msg);
+		free(msg);
+		mpc_err_delete(r.error);
+		return x;
+	}
 
+	return r.output;
 
-	//Parsers
-	//we dynamically create new parser objects 
-	//the first 3 parsers essentially build the structure of our "sentences"
-	//hence: the grammar
+}
 
-	//Chapter 9 update
-	//edited towards S-Expressions
-	mpc_parser_t* Number = mpc_new("number");
-	mpc_parser_t* Symbol = mpc_new("symbol");
-	mpc_parser_t* Sexpr = mpc_new("sexpr");
-	mpc_parser_t* Expr = mpc_new("expr");
+//reads with the reader, if input is NULL f is read instead
+static lval* read_reader(char* filename, char* input, FILE* f){
+	if(input){ return lval_read_string(filename, input); }
+	return lval_read_file(filename, f);
 
-	//chapter 10, added Qexpr
-	mpc_parser_t* Qexpr = mpc_new("qexpr");
+}
 
-	//This parser is essentially the "sentence" itself, it will be built
-	//from the components above 
-	mpc_parser_t* Jlispy = mpc_new("jlispy");
+//reads a whole input into a sexpr of its expressions, a syntax error comes
+//back as a LVAL_ERR instead
+//if input is NULL f is read instead, -v reads twice so it needs input
+//mode is 'm' for the mpc grammar, 'v' to check the reader against it,
+//anything else for just the reader
+static lval* read_input(char mode, char* filename, char* input, FILE* f, mpc_parser_t* Jlispy){
+	if(mode == 'm'){ return read_mpc(filename, input, f, Jlispy); }
+
+	lval* x = read_reader(filename, input, f);
+	if(mode == 'v'){
+		lval* y = read_mpc(filename, input, NULL, Jlispy);
+
+		//syntax errors word what they expected differently,
+		//they only have to agree on where the error is
+		int same;
+		if(x->type == LVAL_ERR && y->type == LVAL_ERR){
+			char* at = strstr(x->err, ": error:");
+			same = at && strncmp(x->err, y->err, at - x->err + 8) == 0;
+		} else {
+			same = lval_eq(x, y);
+		}
 
+		if(!same){
+			fprintf(stderr, "%s: warning: reader and mpc grammar disagree\n", filename);
+		}
+		lval_del(y);
+	}
+	return x;
+
+}
 
+//reads everything left in f into a string, for the mpc grammar which can't
+//stop part way through
+static char* read_all(FILE* f){
+	long len = 0, max = 65536;
+	char* s = malloc(max + 1);
+	size_t n;
+	while((n = fread(s + len, 1, max - len, f)) > 0){
+		len += n;
+		if(len == max){
+			max *= 2;
+			s = realloc(s, max + 1);
+		}
+	}
+	s[len] = '\0';
+	return s;
+
+}
+
+//runs a script one top level expression at a time, printing each result
+//the reader only holds the expression it is on, the mpc grammar (-m, -v)
+//has to read the whole script first
+//returns 0 if the script had a syntax error
+static int run_file(char mode, char* filename, FILE* f, mpc_parser_t* Jlispy){
+	if(mode != 'r'){
+		//-v reads it twice, so it needs its own copy
+		char* input = mode == 'v' ? read_all(f) : NULL;
+		lval* x = read_input(mode, filename, input, f, Jlispy);
+		free(input);
+		if(x->type == LVAL_ERR){
+			fflush(stdout);
+			fprintf(stderr, "%s\n", x->err);
+			lval_del(x);
+			return 0;
+		}
+
+		//lval_eval takes each cell, so x is left with nothing to free in it
+		for(int i = 0; i < x->count; i++){
+			lval* y = lval_eval(x->cell[i]);
+			lval_println(y);
+			lval_del(y);
+		}
+		x->count = 0;
+		lval_del(x);
+		return 1;
+	}
+
+	lreader* r = lreader_new_file(filename, f);
+	lval* x;
+	while((x = lreader_next(r))){
+		if(r->error){
+			fflush(stdout);
+			fprintf(stderr, "%s\n", x->err);
+			lval_del(x);
+			break;
+		}
+		x = lval_eval(x);
+		lval_println(x);
+		lval_del(x);
+	}
+
+	int ok = !r->error;
+	lreader_del(r);
+	return ok;
+
+}
+
+
+//builds the grammar's parsers, used by -m and -v
+//if image names a file written by an earlier run it is loaded instead,
+//which skips parsing the grammar text, see mpca_lang_image
+//an image that is missing or doesn't match this build is made again from
+//the grammar text and written back, so the next start can load it
+//a file there that isn't an image is left alone, the grammar text is used
+static void load_grammar(char* image, mpc_parser_t* Number, mpc_parser_t* Symbol,
+	mpc_parser_t* Sexpr, mpc_parser_t* Qexpr, mpc_parser_t* Expr, mpc_parser_t* Jlispy){
+
+	//actions that build lvals straight from the grammar, instead of making
+	//a mpc_ast_t tree and reading it afterwards
+	//the root becomes a sexpr holding every expression, like '>' did
+	mpca_action_def_t actions[] = {
+		{"number", lval_action_num},
+		{"symbol", lval_action_sym},
+		{"sexpr", lval_action_sexpr},
+		{"qexpr", lval_action_qexpr},
+		{"jlispy", lval_action_sexpr},
+		{NULL, NULL}
+	};
+
+	//the image is read whole, mpca_lang_image takes it as bytes
+	//it is only written back if nothing is there yet, or an image is
+	errno = 0;
+	FILE* f = image ? fopen(image, "rb") : NULL;
+	int save = image && !f && errno == ENOENT;
+	if(f){
+		fseek(f, 0, SEEK_END);
+		long len = ftell(f);
+		rewind(f);
+		char* bytes = malloc(len > 0 ? len : 1);
+		size_t n = fread(bytes, 1, len > 0 ? len : 0, f);
+		fclose(f);
+
+		mpc_err_t* err = mpca_lang_image(bytes, n, actions, (mpc_dtor_t)lval_del, 6,
+			Number, Symbol, Sexpr, Qexpr, Expr, Jlispy);
+		save = n >= 4 && memcmp(bytes, "MPCI", 4) == 0;
+		free(bytes);
+		if(!err){ return; }
+		mpc_err_delete(err);
+	}
 
 	//Defining parsers with the following language
 	//uses Regular expressions to define rules 
 
-
 	//chapter 10, added more symbols for Q-expressions
-	mpca_lang(MPCA_LANG_DEFAULT, 
+	mpca_lang_actions(MPCA_LANG_DEFAULT,
 		"                                                              \
 		number   : /-?[0-9]+/ ;                                        \
         symbol : \"list\" | \"head\" | \"tail\"                        \
@@ -682,60 +359,181 @@ int main(int argc, char** argv){
 		expr     : <number> | <symbol> | <sexpr> | <qexpr>;            \
 		jlispy   : /^/ <expr>* /$/ ;                                   \
 		",
+		actions, (mpc_dtor_t)lval_del,
 		Number, Symbol, Sexpr, Qexpr, Expr, Jlispy);
 
+	//written to the side and renamed over, so the file there is either the
+	//old one or a whole new image, never half of one
+	if(save){
+		char* tmp = malloc(strlen(image) + 5);
+		sprintf(tmp, "%s.tmp", image);
+		f = fopen(tmp, "wb");
+		if(!f){
+			free(tmp);
+			return;
+		}
+		mpc_err_t* err = mpca_lang_save(f, 6, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy);
+		int ok = fclose(f) == 0 && !err;
+		if(err){ mpc_err_delete(err); }
 
+		//windows won't rename over a file, so the old image goes first
+#ifdef _WIN32
+		if(ok){ remove(image); }
+#endif
+		if(!ok || rename(tmp, image) != 0){ remove(tmp); }
+		free(tmp);
+	}
 
-	//Prints Lisp version and information on exiting
-	puts("JLispy Version 0.0.1");
-	puts("CTRL+C to Exit\n");
+}
 
 
+int main(int argc, char** argv){
 
 
-	//while(1) is a while true loop
-	while(1){
+	//Parsers, only made for -m and -v, the reader doesn't use them
+	mpc_parser_t* Number = NULL;
+	mpc_parser_t* Symbol = NULL;
+	mpc_parser_t* Sexpr = NULL;
+	mpc_parser_t* Expr = NULL;
+	mpc_parser_t* Qexpr = NULL;
+	mpc_parser_t* Jlispy = NULL;
 
-		//readline lets us prompt and get input in the same function
-		//rather than doing it in to like above 
-		//dynamic allocation of memory
-		char* input = readline("JLispy>>> ");
 
-		//we pass the input to the add_history function which will record the input
-		add_history(input);
 
-		//attempts to parse the user input into parseResult
-		//this if statement will attempt to parse the user input and 
-		//print out the structure of the input
-		mpc_result_t r;
-		if(mpc_parse("<stdin>", input, Jlispy, &r)){
+	//picks the reader, see read_input, -q leaves out the banner
+	//-g names the grammar image, see load_grammar
+	char mode = 'r';
+	int quiet = 0;
+	char* image = NULL;
+	int arg = 1;
+	for(; arg < argc; arg++){
+		if(strcmp(argv[arg], "-m") == 0 || strcmp(argv[arg], "-v") == 0){
+			mode = argv[arg][1];
+		}
+		else if(strcmp(argv[arg], "-q") == 0){ quiet = 1; }
+		else if(strcmp(argv[arg], "-g") == 0 && arg + 1 < argc){ image = argv[++arg]; }
+		else { break; }
+	}
 
-			mpc_ast_t* a = r.output;
-			//used to printout the mpc_ast_t tree
-			// '>' is the root 
-			//mpc_ast_print(a);
+	if(mode != 'r'){
+		//we dynamically create new parser objects 
+		//the first 3 parsers essentially build the structure of our "sentences"
+		//hence: the grammar
 
+		//Chapter 9 update
+		//edited towards S-Expressions
+		Number = mpc_new("number");
+		Symbol = mpc_new("symbol");
+		Sexpr = mpc_new("sexpr");
+		Expr = mpc_new("expr");
 
+		//chapter 10, added Qexpr
+		Qexpr = mpc_new("qexpr");
 
-			//recursively goes through the AST tree
-			//outputs the mathmatical evaluation of the input
-			// lval results = eval(a);
-			// lval_print(results);
+		//This parser is essentially the "sentence" itself, it will be built
+		//from the components above 
+		Jlispy = mpc_new("jlispy");
 
-			lval* x = lval_eval(lval_read(a));
-			lval_println(x);
+		load_grammar(image, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy);
+
+		//the actions only build lvals, so a bad input running them twice
+		//costs nothing and good input skips building errors
+		mpc_two_pass(Jlispy);
+	}
+
+
+
+	//compile mode, the script is read once and written to stdout as C
+	//instead of starting the prompt
+	if(argc - arg == 2 && strcmp(argv[arg], "-c") == 0){
+		FILE* f = fopen(argv[arg+1], "rb");
+		if(!f){
+			fprintf(stderr, "%s: error: Unable to open file!\n", argv[arg+1]);
+			if(Jlispy){ mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy); }
+			return 1;
+		}
+		char* input = mode == 'v' ? read_all(f) : NULL;
+		lval* x = read_input(mode, argv[arg+1], input, f, Jlispy);
+		free(input);
+		fclose(f);
+		if(x->type == LVAL_ERR){
+			fprintf(stderr, "%s\n", x->err);
 			lval_del(x);
+			if(Jlispy){ mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy); }
+			return 1;
+		}
+
+		lval_compile(x, argv[arg+1], stdout);
+		lval_del(x);
+
+		if(Jlispy){ mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy); }
+		return 0;
+	}
 
 
-			//deallocates the mpc_ast_t object
-			mpc_ast_delete(a);
 
-	
+	//batch mode, runs the files given, or stdin if it was piped in,
+	//instead of starting the prompt
+	//results are written out in big blocks rather than a line at a time
+	if(arg < argc || !isatty(0)){
+		setvbuf(stdout, NULL, _IOFBF, 65536);
+		if(!quiet){ puts("JLispy Version 0.0.1"); }
 
+		int ok = 1;
+		for(int i = arg; i < argc && ok; i++){
+			FILE* f = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "rb");
+			if(!f){
+				fprintf(stderr, "%s: error: Unable to open file!\n", argv[i]);
+				ok = 0;
+				break;
+			}
+			ok = run_file(mode, argv[i], f, Jlispy);
+			if(f != stdin){ fclose(f); }
+		}
+		if(arg == argc){ ok = run_file(mode, "<stdin>", stdin, Jlispy); }
+
+		if(Jlispy){ mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy); }
+		return ok ? 0 : 1;
+	}
+
+
+
+	//Prints Lisp version and information on exiting
+	if(!quiet){
+		puts("JLispy Version 0.0.1");
+		puts("CTRL+C to Exit\n");
+	}
+
+
+
+
+	//while(1) is a while true loop
+	while(1){
+
+		//readline lets us prompt and get input in the same function
+		//rather than doing it in to like above 
+		//dynamic allocation of memory
+		char* input = readline("JLispy>>> ");
+
+		//readline gives NULL at the end of input, Ctrl-D
+		if(!input){ break; }
+
+		//we pass the input to the add_history function which will record the input
+		add_history(input);
+
+		//reads the user input into a sexpr, then evaluates it
+		//a syntax error is printed the way mpc_err_print prints it
+		lval* x = read_input(mode, "<stdin>", input, NULL, Jlispy);
+		if(x->type == LVAL_ERR){
+			printf("%s\n", x->err);
+			lval_del(x);
 		}
 		else{
-			mpc_err_print(r.error);
-			mpc_err_delete(r.error);
+			//recursively goes through the lval tree
+			//outputs the mathmatical evaluation of the input
+			x = lval_eval(x);
+			lval_println(x);
+			lval_del(x);
 		}
 
 
@@ -745,8 +543,8 @@ int main(int argc, char** argv){
 
 	}
 
-	//deletes our parsers 
-	mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy);
+	//deletes our parsers, if they were made
+	if(Jlispy){ mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Jlispy); }
 
 	return 0;
 }
\ No newline at end of file